@@ -0,0 +1,287 @@
+//
+//  EagleDiscovery.cpp
+//  CEagleDiscovery
+//
+//  WeatherEagle X2 plugin
+
+#include "EagleDiscovery.h"
+
+CEagleDiscovery::CEagleDiscovery()
+{
+    m_nState = DISCOVERY_IDLE;
+    m_bCancel = false;
+    m_Multi = nullptr;
+    m_nElapsedMs = 0;
+}
+
+CEagleDiscovery::~CEagleDiscovery()
+{
+    cancel();
+}
+
+bool CEagleDiscovery::parseIpv4(const std::string &sAddress, uint32_t &nAddress)
+{
+    int nParts = 0;
+    int nValue = -1;
+
+    nAddress = 0;
+    for(size_t i = 0; i <= sAddress.size(); i++) {
+        if(i == sAddress.size() || sAddress[i] == '.') {
+            if(nValue < 0 || nValue > 255 || ++nParts > 4)
+                return false;
+            nAddress = (nAddress << 8) | uint32_t(nValue);
+            nValue = -1;
+        }
+        else if(isdigit((unsigned char)sAddress[i])) {
+            nValue = (nValue < 0 ? 0 : nValue * 10) + (sAddress[i] - '0');
+            if(nValue > 255)
+                return false;
+        }
+        else
+            return false;
+    }
+    return nParts == 4;
+}
+
+bool CEagleDiscovery::expandTargets(const std::string &sAddress, const std::vector<int> &vPorts, std::vector<EagleDiscoveryTarget> &vTargets)
+{
+    std::string sHost = sAddress;
+    int nPrefix = 24;
+    uint32_t nAddress;
+    uint32_t nMask;
+    uint32_t nFirst;
+    uint32_t nLast;
+    size_t nSlash;
+    EagleDiscoveryTarget Target;
+
+    vTargets.clear();
+    if(vPorts.empty())
+        return false;
+
+    nSlash = sHost.find('/');
+    if(nSlash != std::string::npos) {
+        nPrefix = atoi(sHost.c_str() + nSlash + 1);
+        sHost.erase(nSlash);
+        if(nPrefix < DISCOVERY_MIN_PREFIX || nPrefix > 32)
+            return false;
+    }
+    if(sHost == "localhost")
+        sHost = "127.0.0.1";
+
+    if(!parseIpv4(sHost, nAddress)) {
+        // host name, nothing to sweep
+        if(sHost.empty() || nSlash != std::string::npos)
+            return false;
+        for(int nPort : vPorts) {
+            Target.sIpAddress = sHost;
+            Target.nTcpPort = nPort;
+            vTargets.push_back(Target);
+        }
+        return true;
+    }
+
+    nMask = nPrefix == 32 ? 0xFFFFFFFF : ~(0xFFFFFFFF >> nPrefix);
+    nFirst = nAddress & nMask;
+    nLast = nFirst | ~nMask;
+    if(nPrefix < 31) {
+        // skip the network and broadcast addresses
+        nFirst++;
+        nLast--;
+    }
+    for(uint32_t nHost = nFirst; nHost <= nLast && nHost >= nFirst; nHost++) {
+        Target.sIpAddress = std::to_string(nHost >> 24) + "." + std::to_string((nHost >> 16) & 0xFF) + "." +
+                            std::to_string((nHost >> 8) & 0xFF) + "." + std::to_string(nHost & 0xFF);
+        for(int nPort : vPorts) {
+            Target.nTcpPort = nPort;
+            vTargets.push_back(Target);
+        }
+        if(nHost == 0xFFFFFFFF)
+            break;
+    }
+    return true;
+}
+
+#pragma mark - scan
+
+int CEagleDiscovery::scan(const std::vector<EagleDiscoveryTarget> &vTargets, std::vector<EagleDiscoveryHit> &vHits)
+{
+    std::vector<DiscoveryRequest> vRequests;
+    EagleDiscoveryHit Hit;
+    DiscoveryRequest *pRequest;
+    CURLMsg *pMsg;
+    CURLM *pMulti;
+    size_t nNext = 0;
+    int nActive = 0;
+    int nRunning;
+    int nMsgLeft;
+
+    vHits.clear();
+    if(vTargets.empty())
+        return PLUGIN_OK;
+    if(!CCurlRuntime::acquire())
+        return ERR_CMDFAILED;
+    pMulti = curl_multi_init();
+    if(!pMulti) {
+        CCurlRuntime::release();
+        return ERR_CMDFAILED;
+    }
+    {
+        const std::lock_guard<std::mutex> lock(m_MultiMutex);
+        m_Multi = pMulti;
+    }
+
+    // fixed pool of easy handles, each one moves on to the next target when its request ends
+    vRequests.resize(std::min(vTargets.size(), size_t(DISCOVERY_MAX_CONCURRENT)));
+    for(DiscoveryRequest &Request : vRequests) {
+        Request.pCurl = curl_easy_init();
+        if(!Request.pCurl)
+            continue;
+        setupRequest(Request, vTargets[nNext]);
+        Request.nTarget = nNext++;
+        curl_multi_add_handle(pMulti, Request.pCurl);
+        nActive++;
+    }
+
+    while(nActive && !m_bCancel) {
+        curl_multi_perform(pMulti, &nRunning);
+        while((pMsg = curl_multi_info_read(pMulti, &nMsgLeft))) {
+            if(pMsg->msg != CURLMSG_DONE)
+                continue;
+            pRequest = nullptr;
+            curl_easy_getinfo(pMsg->easy_handle, CURLINFO_PRIVATE, (char **)&pRequest);
+            curl_multi_remove_handle(pMulti, pMsg->easy_handle);
+            nActive--;
+            if(!pRequest)
+                continue;
+            if(pMsg->data.result == CURLE_OK && parseHit(*pRequest, vTargets[pRequest->nTarget], Hit))
+                vHits.push_back(Hit);
+            if(nNext < vTargets.size()) {
+                setupRequest(*pRequest, vTargets[nNext]);
+                pRequest->nTarget = nNext++;
+                curl_multi_add_handle(pMulti, pRequest->pCurl);
+                nActive++;
+            }
+        }
+        if(nActive && !m_bCancel)
+            curl_multi_poll(pMulti, NULL, 0, 100, NULL);
+    }
+
+    for(DiscoveryRequest &Request : vRequests) {
+        if(!Request.pCurl)
+            continue;
+        curl_multi_remove_handle(pMulti, Request.pCurl);
+        curl_easy_cleanup(Request.pCurl);
+    }
+    {
+        const std::lock_guard<std::mutex> lock(m_MultiMutex);
+        m_Multi = nullptr;
+    }
+    curl_multi_cleanup(pMulti);
+    CCurlRuntime::release();
+
+    std::sort(vHits.begin(), vHits.end(), [](const EagleDiscoveryHit &A, const EagleDiscoveryHit &B) {
+        uint32_t nA = 0, nB = 0;
+        parseIpv4(A.sIpAddress, nA);
+        parseIpv4(B.sIpAddress, nB);
+        if(nA != nB)
+            return nA < nB;
+        if(A.sIpAddress != B.sIpAddress)
+            return A.sIpAddress < B.sIpAddress;
+        return A.nTcpPort < B.nTcpPort;
+    });
+    return m_bCancel ? ERR_ABORTEDPROCESS : PLUGIN_OK;
+}
+
+void CEagleDiscovery::setupRequest(DiscoveryRequest &Request, const EagleDiscoveryTarget &Target)
+{
+    std::string sUrl = CWeatherEagle::makeBaseUrl(Target.sIpAddress, Target.nTcpPort, false) + "/getinfo";
+
+    Request.sResponse.clear();
+    curl_easy_setopt(Request.pCurl, CURLOPT_URL, sUrl.c_str());
+    curl_easy_setopt(Request.pCurl, CURLOPT_HTTPGET, 1L);
+    curl_easy_setopt(Request.pCurl, CURLOPT_WRITEFUNCTION, CWeatherEagle::writeFunction);
+    curl_easy_setopt(Request.pCurl, CURLOPT_WRITEDATA, &Request.sResponse);
+    curl_easy_setopt(Request.pCurl, CURLOPT_PRIVATE, &Request);
+    curl_easy_setopt(Request.pCurl, CURLOPT_FAILONERROR, 1L);
+    curl_easy_setopt(Request.pCurl, CURLOPT_CONNECTTIMEOUT_MS, long(DISCOVERY_CONNECT_TIMEOUT_MS));
+    curl_easy_setopt(Request.pCurl, CURLOPT_TIMEOUT_MS, long(DISCOVERY_TIMEOUT_MS));
+    // every request goes to a different host, don't keep the connections around
+    curl_easy_setopt(Request.pCurl, CURLOPT_FORBID_REUSE, 1L);
+}
+
+// an Eagle answers /getinfo with result OK and its firmware version
+bool CEagleDiscovery::parseHit(DiscoveryRequest &Request, const EagleDiscoveryTarget &Target, EagleDiscoveryHit &Hit)
+{
+    json jInfo;
+    curl_off_t nTotalUs = 0;
+
+    try {
+        jInfo = json::parse(Request.sResponse);
+        if(jInfo.at("result").get<std::string>() != "OK" || !jInfo.contains("firmwareversion"))
+            return false;
+        Hit.sFirmware = jInfo["firmwareversion"].is_string() ? jInfo["firmwareversion"].get<std::string>() : jInfo["firmwareversion"].dump();
+        if(jInfo.contains("model") && jInfo["model"].is_string())
+            Hit.sModel = jInfo["model"].get<std::string>();
+        else
+            Hit.sModel = "Eagle Manager X";
+    }
+    catch (json::exception& e) {
+        return false;
+    }
+    curl_easy_getinfo(Request.pCurl, CURLINFO_TOTAL_TIME_T, &nTotalUs);
+    Hit.sIpAddress = Target.sIpAddress;
+    Hit.nTcpPort = Target.nTcpPort;
+    Hit.nLatencyMs = int(nTotalUs / 1000);
+    return true;
+}
+
+#pragma mark - background scan
+
+bool CEagleDiscovery::start(const std::vector<EagleDiscoveryTarget> &vTargets)
+{
+    if(m_nState == DISCOVERY_RUNNING)
+        return false;
+    if(m_th.joinable())
+        m_th.join();
+
+    m_vTargets = vTargets;
+    m_bCancel = false;
+    m_nState = DISCOVERY_RUNNING;
+    m_th = std::thread(&CEagleDiscovery::run, this);
+    return true;
+}
+
+void CEagleDiscovery::cancel()
+{
+    m_bCancel = true;
+    {
+        const std::lock_guard<std::mutex> lock(m_MultiMutex);
+        if(m_Multi)
+            curl_multi_wakeup(m_Multi);
+    }
+    if(m_th.joinable())
+        m_th.join();
+    m_bCancel = false;
+    m_nState = DISCOVERY_IDLE;
+}
+
+void CEagleDiscovery::getResults(std::vector<EagleDiscoveryHit> &vHits, int &nElapsedMs)
+{
+    const std::lock_guard<std::mutex> lock(m_ResultMutex);
+    vHits = m_vHits;
+    nElapsedMs = m_nElapsedMs;
+}
+
+void CEagleDiscovery::run()
+{
+    std::vector<EagleDiscoveryHit> vHits;
+    std::chrono::steady_clock::time_point tStart = std::chrono::steady_clock::now();
+
+    scan(m_vTargets, vHits);
+    {
+        const std::lock_guard<std::mutex> lock(m_ResultMutex);
+        m_vHits.swap(vHits);
+        m_nElapsedMs = int(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - tStart).count());
+    }
+    m_nState = DISCOVERY_DONE;
+}
@@ -0,0 +1,89 @@
+//
+//  EagleDiscovery.h
+//  CEagleDiscovery
+//
+//  WeatherEagle X2 plugin
+//
+//  Finds Eagle Manager X devices on the local network by asking every host of a
+//  /24 for /getinfo. The requests run on one curl multi handle (non blocking
+//  sockets) with at most DISCOVERY_MAX_CONCURRENT in flight and short deadlines,
+//  so hosts that don't exist cost one connect timeout per wave, about a second for a /24.
+
+#ifndef __EagleDiscovery__
+#define __EagleDiscovery__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <atomic>
+
+#include "WeatherEagle.h"
+
+#define DISCOVERY_MAX_CONCURRENT        64
+#define DISCOVERY_CONNECT_TIMEOUT_MS    250
+#define DISCOVERY_TIMEOUT_MS            800     // whole /getinfo request
+#define DISCOVERY_MIN_PREFIX            22      // never scan more than 1024 hosts
+#define DISCOVERY_DEFAULT_PORT          1380
+
+enum DiscoveryStates {DISCOVERY_IDLE=0, DISCOVERY_RUNNING, DISCOVERY_DONE};
+
+typedef struct {
+    std::string sIpAddress;
+    int         nTcpPort;
+} EagleDiscoveryTarget;
+
+typedef struct {
+    std::string sIpAddress;
+    int         nTcpPort;
+    std::string sModel;
+    std::string sFirmware;
+    int         nLatencyMs;
+} EagleDiscoveryHit;
+
+class CEagleDiscovery
+{
+public:
+    CEagleDiscovery();
+    ~CEagleDiscovery();
+
+    // "a.b.c.d" scans the /24 around it, "a.b.c.d/nn" that subnet, anything else is a single host
+    static bool expandTargets(const std::string &sAddress, const std::vector<int> &vPorts, std::vector<EagleDiscoveryTarget> &vTargets);
+
+    // blocking scan, returns the devices sorted by address then port
+    int     scan(const std::vector<EagleDiscoveryTarget> &vTargets, std::vector<EagleDiscoveryHit> &vHits);
+
+    // same on a background thread
+    bool    start(const std::vector<EagleDiscoveryTarget> &vTargets);
+    void    cancel();
+    int     getState() { return m_nState; }
+    // valid once the state is DISCOVERY_DONE
+    void    getResults(std::vector<EagleDiscoveryHit> &vHits, int &nElapsedMs);
+
+private:
+    typedef struct {
+        CURL        *pCurl;
+        size_t      nTarget;
+        std::string sResponse;
+    } DiscoveryRequest;
+
+    void    run();
+    void    setupRequest(DiscoveryRequest &Request, const EagleDiscoveryTarget &Target);
+    bool    parseHit(DiscoveryRequest &Request, const EagleDiscoveryTarget &Target, EagleDiscoveryHit &Hit);
+    static bool parseIpv4(const std::string &sAddress, uint32_t &nAddress);
+
+    std::thread                         m_th;
+    std::atomic<int>                    m_nState;
+    std::atomic<bool>                   m_bCancel;
+    std::mutex                          m_MultiMutex;
+    CURLM                               *m_Multi;       // set while a scan runs, for cancel()
+
+    std::vector<EagleDiscoveryTarget>   m_vTargets;     // background scan input
+    std::mutex                          m_ResultMutex;
+    std::vector<EagleDiscoveryHit>      m_vHits;
+    int                                 m_nElapsedMs;
+};
+
+#endif
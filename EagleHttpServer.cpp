@@ -0,0 +1,714 @@
+//
+//  EagleHttpServer.cpp
+//  CEagleHttpServer
+//
+//  WeatherEagle X2 plugin
+
+#include "EagleHttpServer.h"
+
+#ifdef SB_WIN_BUILD
+#define strncasecmp     _strnicmp
+#define strcasecmp      _stricmp
+#endif
+
+#include <charconv>
+#include <algorithm>
+
+CEagleHttpServer::CEagleHttpServer(const std::string &sBindAddress, int nPort, bool bAlpaca)
+{
+    m_sBindAddress = sBindAddress.empty() ? "0.0.0.0" : sBindAddress;
+    m_nPort = nPort;
+    m_pDevice = nullptr;
+    m_bAlpaca = bAlpaca;
+    m_bAlpacaConnected = false;
+    m_nServerTransactionID = 0;
+    m_bRunning = false;
+    m_Listen = EAGLE_INVALID_SOCKET;
+    m_Wake = EAGLE_INVALID_SOCKET;
+    m_bResyncAll = false;
+    m_nDroppedEvents = 0;
+    snprintf(m_szVersion, sizeof(m_szVersion), "%.2f", PLUGIN_VERSION);
+    m_nSessionId = 0;
+    m_nLastSeq = 0;
+}
+
+CEagleHttpServer::~CEagleHttpServer()
+{
+    stop();
+}
+
+bool CEagleHttpServer::start(CWeatherEagle *pDevice)
+{
+    struct sockaddr_in Addr;
+    int nOn = 1;
+
+    if(m_bRunning)
+        return true;
+
+    if(!eagleSocketStartup())
+        return false;
+
+    m_pDevice = pDevice;
+    // the sample sequence restarts with each link, the session id keeps etags and event ids unique
+    m_nSessionId = (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    m_nLastSeq = 0;
+
+    memset(&Addr, 0, sizeof(Addr));
+    Addr.sin_family = AF_INET;
+    Addr.sin_port = htons((uint16_t)m_nPort);
+    if(inet_pton(AF_INET, m_sBindAddress.c_str(), &Addr.sin_addr) != 1)
+        goto failed;
+
+    m_Listen = socket(AF_INET, SOCK_STREAM, 0);
+    if(m_Listen == EAGLE_INVALID_SOCKET)
+        goto failed;
+    setsockopt(m_Listen, SOL_SOCKET, SO_REUSEADDR, (const char *)&nOn, sizeof(nOn));
+    if(bind(m_Listen, (struct sockaddr *)&Addr, sizeof(Addr)) != 0 || listen(m_Listen, HTTP_LISTEN_BACKLOG) != 0)
+        goto failed;
+    eagleSetNonBlocking(m_Listen);
+
+    // lets publish and stop interrupt the poll
+    m_Wake = eagleOpenWakeSocket();
+    if(m_Wake == EAGLE_INVALID_SOCKET)
+        goto failed;
+
+    m_bRunning = true;
+    m_th = std::thread(&CEagleHttpServer::run, this);
+    return true;
+
+failed:
+    eagleCloseSocket(m_Listen);
+    eagleCloseSocket(m_Wake);
+    m_Listen = EAGLE_INVALID_SOCKET;
+    m_Wake = EAGLE_INVALID_SOCKET;
+    eagleSocketCleanup();
+    return false;
+}
+
+void CEagleHttpServer::stop()
+{
+    if(!m_bRunning)
+        return;
+
+    m_bRunning = false;
+    eagleWake(m_Wake);
+    if(m_th.joinable())
+        m_th.join();
+
+    for(HttpClient &Client : m_vClients)
+        eagleCloseSocket(Client.fd);
+    m_vClients.clear();
+    eagleCloseSocket(m_Listen);
+    eagleCloseSocket(m_Wake);
+    m_Listen = EAGLE_INVALID_SOCKET;
+    m_Wake = EAGLE_INVALID_SOCKET;
+    eagleSocketCleanup();
+}
+
+// called by the poller, serialize once here so requests only copy bytes
+void CEagleHttpServer::publish(const WeatherEagleSnapshot &Snapshot)
+{
+    std::shared_ptr<HttpSnapshot> pHttp = std::make_shared<HttpSnapshot>();
+    WeatherEagleMetrics Metrics;
+    json jSnapshot;
+    json jDelta;
+    std::string sJson;
+    std::string sId;
+    std::string sTag;
+
+    m_pDevice->getMetrics(Metrics);
+
+    // sequence went back, the device relinked under us: new session so clients don't match old ids
+    if(Snapshot.nSeq <= m_nLastSeq)
+        m_nSessionId++;
+    m_nLastSeq = Snapshot.nSeq;
+    sTag = std::to_string(m_nSessionId) + "-" + std::to_string(Snapshot.nSeq);
+
+    jSnapshot["seq"] = Snapshot.nSeq;
+    jSnapshot["timestamp_ms"] = Snapshot.nWallTimeMs;
+    jSnapshot["warm_start"] = (Snapshot.nFlags & SNAPSHOT_FLAG_WARM_START) != 0;
+    jSnapshot["temperature"] = Snapshot.dTemp;
+    jSnapshot["humidity"] = Snapshot.dPercentHumdity;
+    jSnapshot["dewpoint"] = Snapshot.dDewPointTemp;
+    jSnapshot["pressure"] = Snapshot.dBarometricPressure;
+    jSnapshot["ext_temperature"] = {Snapshot.dExtTemp[0], Snapshot.dExtTemp[1], Snapshot.dExtTemp[2]};
+    jSnapshot["model"] = Snapshot.szModel;
+    jSnapshot["firmware"] = Snapshot.szFirmware;
+    // derived values
+    jSnapshot["dewpoint_depression"] = Snapshot.dTemp - Snapshot.dDewPointTemp;
+    jSnapshot["latency_ms"] = Metrics.nLatencyMs;
+    jSnapshot["breaker_state"] = Metrics.nBreakerState;
+    sJson = jSnapshot.dump();
+
+    pHttp->nTimestampMs = Snapshot.nTimestampMs;
+    pHttp->Snapshot = Snapshot;
+    pHttp->sEtag = "\"" + sTag + "\"";
+    // the age is the only per request value, it goes first: {"age_ms":<age>,<tail>
+    pHttp->sBodyTail = sJson.size() > 2 ? "," + sJson.substr(1) : "}";
+
+    std::atomic_store(&m_pSnapshot, std::shared_ptr<const HttpSnapshot>(pHttp));
+
+    // event stream: the full state for new or resynced subscribers, the changed fields for the others
+    sId = "id: " + sTag + "\n";
+    std::atomic_store(&m_pFullEvent, SharedBuffer(std::make_shared<const std::string>(sId + "event: snapshot\ndata: " + sJson + "\n\n")));
+
+    // nothing moved past its deadband, subscribers have nothing to update
+    if(!Snapshot.nChangedFields && m_jPrevious.is_object())
+        return;
+
+    for(auto it = jSnapshot.begin(); it != jSnapshot.end(); ++it) {
+        if(it.key() == "seq" || it.key() == "timestamp_ms" || !m_jPrevious.contains(it.key()) || m_jPrevious[it.key()] != it.value())
+            jDelta[it.key()] = it.value();
+    }
+    m_jPrevious = std::move(jSnapshot);
+
+    {
+        const std::lock_guard<std::mutex> lock(m_EventMutex);
+        if(m_vPendingEvents.size() >= SSE_MAX_QUEUE) {
+            // server thread is behind, everybody gets the latest full state instead
+            m_vPendingEvents.clear();
+            m_bResyncAll = true;
+        }
+        else if(!m_bResyncAll) {
+            m_vPendingEvents.push_back(std::make_shared<const std::string>(sId + "event: delta\ndata: " + jDelta.dump() + "\n\n"));
+        }
+    }
+    eagleWake(m_Wake);
+}
+
+void CEagleHttpServer::run()
+{
+    std::vector<struct pollfd> vFds;
+    std::chrono::steady_clock::time_point tNow;
+    const SharedBuffer pHeartbeat = std::make_shared<const std::string>(": keep alive\n\n");
+    int64_t nIdleMs;
+    size_t i;
+
+    while(m_bRunning) {
+        vFds.clear();
+        vFds.push_back({m_Wake, POLLIN, 0});
+        vFds.push_back({m_Listen, POLLIN, 0});
+        for(HttpClient &Client : m_vClients) {
+            short nEvents = POLLIN;
+            if(hasPendingOutput(Client))
+                nEvents |= POLLOUT;
+            vFds.push_back({Client.fd, nEvents, 0});
+        }
+
+        if(eagle_poll(vFds.data(), (unsigned long)vFds.size(), 1000) < 0)
+            continue;
+        if(!m_bRunning)
+            break;
+
+        if(vFds[0].revents & POLLIN)
+            eagleDrainWake(m_Wake);
+        dispatchEvents();
+
+        // clients first, acceptClients may grow m_vClients and shift the pollfd indexes
+        tNow = std::chrono::steady_clock::now();
+        for(i = 0; i < m_vClients.size(); i++) {
+            HttpClient &Client = m_vClients[i];
+            short nRevents = vFds[i + 2].revents;
+            bool bOk = true;
+
+            if(nRevents & (POLLERR | POLLNVAL))
+                bOk = false;
+            if(bOk && (nRevents & (POLLIN | POLLHUP))) // a hang up reads 0
+                bOk = readClient(Client);
+            if(bOk && hasPendingOutput(Client))
+                bOk = writeClient(Client);
+            if(bOk && Client.bClose && !hasPendingOutput(Client))
+                bOk = false;
+            nIdleMs = std::chrono::duration_cast<std::chrono::milliseconds>(tNow - Client.tLastActivity).count();
+            if(bOk && Client.bStream && !hasPendingOutput(Client)) {
+                if(nIdleMs > SSE_HEARTBEAT_MS)
+                    enqueueEvent(Client, pHeartbeat);
+            }
+            else if(bOk && nIdleMs > HTTP_IDLE_TIMEOUT_MS) {
+                bOk = false;    // idle keep alive connection or subscriber not reading anymore
+            }
+            if(!bOk)
+                closeClient(Client);
+        }
+        m_vClients.erase(std::remove_if(m_vClients.begin(), m_vClients.end(),
+                                        [](const HttpClient &Client) { return Client.fd == EAGLE_INVALID_SOCKET; }),
+                         m_vClients.end());
+
+        if(vFds[1].revents & POLLIN)
+            acceptClients();
+    }
+}
+
+void CEagleHttpServer::acceptClients()
+{
+    eagle_socket_t fd;
+    HttpClient Client;
+    int nOn = 1;
+
+    while((fd = accept(m_Listen, NULL, NULL)) != EAGLE_INVALID_SOCKET) {
+        if(m_vClients.size() >= HTTP_MAX_CLIENTS) {
+            eagleCloseSocket(fd);
+            continue;
+        }
+        eagleSetNonBlocking(fd);
+        eagleSetNoSigPipe(fd);
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (const char *)&nOn, sizeof(nOn));
+        Client.fd = fd;
+        Client.sIn.clear();
+        Client.sOut.clear();
+        Client.nOutPos = 0;
+        Client.bClose = false;
+        Client.bStream = false;
+        Client.qEvents.clear();
+        Client.nEventPos = 0;
+        Client.tLastActivity = std::chrono::steady_clock::now();
+        m_vClients.push_back(Client);
+    }
+}
+
+// returns false if the connection must be closed
+bool CEagleHttpServer::readClient(HttpClient &Client)
+{
+    char szBuffer[2048];
+    long nRead;
+    size_t nEnd;
+    size_t nBodyLen;
+
+    nRead = recv(Client.fd, szBuffer, sizeof(szBuffer), 0);
+    if(nRead <= 0)
+        return false;   // closed by the peer or error
+    Client.tLastActivity = std::chrono::steady_clock::now();
+    if(Client.bClose || Client.bStream)
+        return true;    // ignore anything after a request we are closing on or a subscription
+    Client.sIn.append(szBuffer, size_t(nRead));
+
+    // pipelined requests are answered in order
+    while((nEnd = Client.sIn.find("\r\n\r\n")) != std::string::npos) {
+        std::string sRequest = Client.sIn.substr(0, nEnd + 2);
+        nBodyLen = size_t(atol(headerValue(sRequest, "Content-Length").c_str()));
+        if(nBodyLen > HTTP_MAX_REQUEST_SIZE) {
+            Client.sIn.resize(HTTP_MAX_REQUEST_SIZE + 1);   // rejected below
+            break;
+        }
+        if(Client.sIn.size() < nEnd + 4 + nBodyLen)
+            break;  // wait for the rest of the body
+        handleRequest(Client, sRequest, Client.sIn.substr(nEnd + 4, nBodyLen));
+        Client.sIn.erase(0, nEnd + 4 + nBodyLen);
+        if(Client.bClose)
+            break;
+    }
+    if(Client.sIn.size() > HTTP_MAX_REQUEST_SIZE) {
+        Client.sIn.clear();
+        sendResponse(Client, "431 Request Header Fields Too Large", "text/plain", "", "request too large\n", false);
+        Client.bClose = true;
+    }
+    return true;
+}
+
+bool CEagleHttpServer::writeClient(HttpClient &Client)
+{
+    const std::string *pBuffer;
+    size_t *pPos;
+    long nSent;
+
+    // response first, then the queued events of a subscriber
+    if(Client.nOutPos < Client.sOut.size()) {
+        pBuffer = &Client.sOut;
+        pPos = &Client.nOutPos;
+    }
+    else if(!Client.qEvents.empty()) {
+        pBuffer = Client.qEvents.front().get();
+        pPos = &Client.nEventPos;
+    }
+    else {
+        return true;
+    }
+
+    nSent = send(Client.fd, pBuffer->data() + *pPos, pBuffer->size() - *pPos, EAGLE_SEND_FLAGS);
+    if(nSent < 0)
+        return eagleWouldBlock();
+    *pPos += size_t(nSent);
+    if(*pPos >= pBuffer->size()) {
+        if(pBuffer == &Client.sOut) {
+            Client.sOut.clear();
+            Client.nOutPos = 0;
+        }
+        else {
+            Client.qEvents.pop_front();
+            Client.nEventPos = 0;
+        }
+    }
+    Client.tLastActivity = std::chrono::steady_clock::now();
+    return true;
+}
+
+bool CEagleHttpServer::hasPendingOutput(const HttpClient &Client)
+{
+    return Client.nOutPos < Client.sOut.size() || !Client.qEvents.empty();
+}
+
+void CEagleHttpServer::handleRequest(HttpClient &Client, const std::string &sRequest, const std::string &sBody)
+{
+    std::string sMethod;
+    std::string sPath;
+    std::string sQuery;
+    size_t nQuery;
+    std::string sConnection;
+    size_t nSp1, nSp2;
+    bool bHead;
+
+    nSp1 = sRequest.find(' ');
+    nSp2 = nSp1 == std::string::npos ? std::string::npos : sRequest.find(' ', nSp1 + 1);
+    if(nSp2 == std::string::npos) {
+        sendResponse(Client, "400 Bad Request", "text/plain", "", "bad request\n", false);
+        Client.bClose = true;
+        return;
+    }
+    sMethod = sRequest.substr(0, nSp1);
+    sPath = sRequest.substr(nSp1 + 1, nSp2 - nSp1 - 1);
+    nQuery = sPath.find('?');
+    if(nQuery != std::string::npos) {
+        sQuery = sPath.substr(nQuery + 1);
+        sPath.resize(nQuery);
+    }
+
+    sConnection = headerValue(sRequest, "Connection");
+    if(sConnection == "close" || sRequest.compare(nSp2 + 1, 8, "HTTP/1.0") == 0)
+        Client.bClose = true;
+
+    bHead = sMethod == "HEAD";
+    if(m_bAlpaca && (sPath.compare(0, 5, "/api/") == 0 || sPath.compare(0, 12, "/management/") == 0)) {
+        if(sMethod == "GET" || sMethod == "PUT")
+            serveAlpaca(Client, sMethod == "PUT", sPath, sMethod == "PUT" ? sBody : sQuery);
+        else
+            sendResponse(Client, "405 Method Not Allowed", "text/plain", "Allow: GET, PUT\r\n", "method not allowed\n", false);
+        return;
+    }
+    if(sMethod != "GET" && !bHead) {
+        sendResponse(Client, "405 Method Not Allowed", "text/plain", "Allow: GET, HEAD\r\n", "method not allowed\n", false);
+        return;
+    }
+
+    if(sPath == "/" || sPath == "/snapshot")
+        serveSnapshot(Client, headerValue(sRequest, "If-None-Match"), bHead);
+    else if(sPath == "/events")
+        serveEvents(Client, bHead);
+    else
+        sendResponse(Client, "404 Not Found", "text/plain", "", "not found\n", bHead);
+}
+
+void CEagleHttpServer::serveSnapshot(HttpClient &Client, const std::string &sIfNoneMatch, bool bHead)
+{
+    std::shared_ptr<const HttpSnapshot> pHttp = std::atomic_load(&m_pSnapshot);
+    std::string sBody;
+    char szAge[24];
+    int64_t nNowMs;
+
+    if(!pHttp) {
+        sendResponse(Client, "503 Service Unavailable", "text/plain", "Retry-After: 5\r\n", "no data yet\n", bHead);
+        return;
+    }
+
+    // If-None-Match may hold a list of etags or *
+    if(!sIfNoneMatch.empty() && (sIfNoneMatch == "*" || sIfNoneMatch.find(pHttp->sEtag) != std::string::npos)) {
+        sendResponse(Client, "304 Not Modified", nullptr, "ETag: " + pHttp->sEtag + "\r\n", "", true);
+        return;
+    }
+
+    nNowMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    std::to_chars_result Res = std::to_chars(szAge, szAge + sizeof(szAge) - 1, std::max<int64_t>(nNowMs - pHttp->nTimestampMs, 0));
+    *Res.ptr = 0;
+    sBody.reserve(pHttp->sBodyTail.size() + 32);
+    sBody.append("{\"age_ms\":");
+    sBody.append(szAge);
+    sBody.append(pHttp->sBodyTail);
+    sendResponse(Client, "200 OK", "application/json", "ETag: " + pHttp->sEtag + "\r\nCache-Control: no-cache\r\n", sBody, bHead);
+}
+
+void CEagleHttpServer::serveEvents(HttpClient &Client, bool bHead)
+{
+    SharedBuffer pFull = std::atomic_load(&m_pFullEvent);
+
+    Client.sOut.append("HTTP/1.1 200 OK\r\n"
+                       "Content-Type: text/event-stream\r\n"
+                       "Cache-Control: no-cache\r\n"
+                       "X-Accel-Buffering: no\r\n\r\n");
+    if(bHead) {
+        Client.bClose = true;
+        return;
+    }
+    Client.sOut.append("retry: 5000\n\n");
+    Client.bStream = true;
+    // start from the full state, deltas follow
+    if(pFull)
+        Client.qEvents.push_back(pFull);
+}
+
+// server thread, fan the pending events out to the subscribers
+void CEagleHttpServer::dispatchEvents()
+{
+    std::vector<SharedBuffer> vEvents;
+    bool bResyncAll;
+
+    {
+        const std::lock_guard<std::mutex> lock(m_EventMutex);
+        vEvents.swap(m_vPendingEvents);
+        bResyncAll = m_bResyncAll;
+        m_bResyncAll = false;
+    }
+    if(vEvents.empty() && !bResyncAll)
+        return;
+
+    for(HttpClient &Client : m_vClients) {
+        if(!Client.bStream)
+            continue;
+        if(bResyncAll)
+            resyncClient(Client);
+        for(const SharedBuffer &pEvent : vEvents)
+            enqueueEvent(Client, pEvent);
+    }
+}
+
+void CEagleHttpServer::enqueueEvent(HttpClient &Client, const SharedBuffer &pEvent)
+{
+    if(Client.qEvents.size() >= SSE_MAX_QUEUE) {
+        // slow subscriber, drop its backlog and jump to the latest state
+        resyncClient(Client);
+        return;
+    }
+    Client.qEvents.push_back(pEvent);
+}
+
+void CEagleHttpServer::resyncClient(HttpClient &Client)
+{
+    SharedBuffer pFull = std::atomic_load(&m_pFullEvent);
+    size_t nKeep = Client.nEventPos ? 1 : 0;    // never cut an event in the middle
+
+    if(Client.qEvents.size() > nKeep)
+        m_nDroppedEvents += Client.qEvents.size() - nKeep;
+    Client.qEvents.resize(std::min(Client.qEvents.size(), nKeep));
+    if(pFull)
+        Client.qEvents.push_back(pFull);
+}
+
+void CEagleHttpServer::sendResponse(HttpClient &Client, const char *pszStatus, const char *pszContentType,
+                                    const std::string &sExtraHeaders, const std::string &sBody, bool bHead)
+{
+    std::string &sOut = Client.sOut;
+
+    sOut.append("HTTP/1.1 ");
+    sOut.append(pszStatus);
+    sOut.append("\r\n");
+    if(pszContentType) {
+        sOut.append("Content-Type: ");
+        sOut.append(pszContentType);
+        sOut.append("\r\nContent-Length: ");
+        sOut.append(std::to_string(sBody.size()));
+        sOut.append("\r\n");
+    }
+    sOut.append(sExtraHeaders);
+    if(Client.bClose)
+        sOut.append("Connection: close\r\n");
+    sOut.append("\r\n");
+    if(!bHead)
+        sOut.append(sBody);
+}
+
+void CEagleHttpServer::closeClient(HttpClient &Client)
+{
+    eagleCloseSocket(Client.fd);
+    Client.fd = EAGLE_INVALID_SOCKET;
+}
+
+// case insensitive header lookup, returns the trimmed value or an empty string
+std::string CEagleHttpServer::headerValue(const std::string &sRequest, const char *pszName)
+{
+    size_t nPos = 0;
+    size_t nEnd;
+    size_t nNameLen = strlen(pszName);
+    std::string sValue;
+
+    while((nPos = sRequest.find("\r\n", nPos)) != std::string::npos) {
+        nPos += 2;
+        if(sRequest.size() - nPos > nNameLen && sRequest[nPos + nNameLen] == ':' &&
+           strncasecmp(sRequest.c_str() + nPos, pszName, nNameLen) == 0) {
+            nEnd = sRequest.find("\r\n", nPos);
+            sValue = sRequest.substr(nPos + nNameLen + 1, nEnd == std::string::npos ? std::string::npos : nEnd - nPos - nNameLen - 1);
+            sValue.erase(0, sValue.find_first_not_of(" \t"));
+            sValue.erase(sValue.find_last_not_of(" \t") + 1);
+            return sValue;
+        }
+    }
+    return sValue;
+}
+
+#pragma mark - Alpaca ObservingConditions
+
+void CEagleHttpServer::serveAlpaca(HttpClient &Client, bool bPut, const std::string &sPath, const std::string &sParams)
+{
+    static const std::string sDevicePrefix = "/api/v1/observingconditions/";
+    std::string sTransaction;
+    std::string sProperty;
+    json jResp;
+
+    sTransaction = alpacaParam(sParams, "ClientTransactionID");
+    jResp["ClientTransactionID"] = uint32_t(strtoul(sTransaction.c_str(), NULL, 10));
+    jResp["ServerTransactionID"] = ++m_nServerTransactionID;
+    jResp["ErrorNumber"] = 0;
+    jResp["ErrorMessage"] = "";
+
+    if(sPath == "/management/apiversions") {
+        jResp["Value"] = {1};
+    }
+    else if(sPath == "/management/v1/description") {
+        jResp["Value"] = {{"ServerName", "X2 WeatherEagle"}, {"Manufacturer", "Rodolphe Pineau"},
+                          {"ManufacturerVersion", m_szVersion}, {"Location", ""}};
+    }
+    else if(sPath == "/management/v1/configureddevices") {
+        jResp["Value"] = json::array({{{"DeviceName", "WeatherEagle " + m_pDevice->getDeviceTag()}, {"DeviceType", "ObservingConditions"},
+                                       {"DeviceNumber", 0}, {"UniqueID", "X2_WeatherEagle_" + m_pDevice->getDeviceTag()}}});
+    }
+    else if(sPath.compare(0, sDevicePrefix.size(), sDevicePrefix) == 0 && sPath.compare(sDevicePrefix.size(), 2, "0/") == 0) {
+        sProperty = sPath.substr(sDevicePrefix.size() + 2);
+        std::transform(sProperty.begin(), sProperty.end(), sProperty.begin(), [](unsigned char c) { return char(tolower(c)); });
+        serveAlpacaDevice(Client, bPut, sProperty, sParams, jResp);
+        return;
+    }
+    else {
+        sendResponse(Client, "404 Not Found", "text/plain", "", "unknown device or endpoint\n", false);
+        return;
+    }
+    sendResponse(Client, "200 OK", "application/json", "", jResp.dump(), false);
+}
+
+// every value comes from the cached snapshot, nothing here talks to the Eagle
+void CEagleHttpServer::serveAlpacaDevice(HttpClient &Client, bool bPut, const std::string &sProperty, const std::string &sParams, json &jResp)
+{
+    static const char *UnsupportedSensors[] = {"cloudcover", "rainrate", "skybrightness", "skyquality", "skytemperature",
+                                               "starfwhm", "windspeed", "winddirection", "windgust"};
+    std::shared_ptr<const HttpSnapshot> pHttp = std::atomic_load(&m_pSnapshot);
+    std::string sValue;
+    std::string sSensor;
+    int64_t nNowMs;
+
+    for(const char *pszSensor : UnsupportedSensors) {
+        if(sProperty == pszSensor) {
+            alpacaError(jResp, ALPACA_NOT_IMPLEMENTED, "the Eagle has no such sensor");
+            sendResponse(Client, "200 OK", "application/json", "", jResp.dump(), false);
+            return;
+        }
+    }
+
+    if(bPut) {
+        sValue = alpacaParam(sParams, sProperty == "connected" ? "Connected" : "AveragePeriod");
+        if(sProperty == "connected") {
+            if(strcasecmp(sValue.c_str(), "true") != 0 && strcasecmp(sValue.c_str(), "false") != 0)
+                alpacaError(jResp, ALPACA_INVALID_VALUE, "Connected must be true or false");
+            else
+                m_bAlpacaConnected = strcasecmp(sValue.c_str(), "true") == 0;
+        }
+        else if(sProperty == "averageperiod") {
+            // no averaging, only instantaneous values
+            if(sValue.empty() || atof(sValue.c_str()) != 0.0)
+                alpacaError(jResp, ALPACA_INVALID_VALUE, "only an average period of 0 is supported");
+        }
+        else if(sProperty == "refresh") {
+            m_pDevice->refreshIfStale(0, 0);    // asks the poller, never waits
+        }
+        else if(sProperty == "action" || sProperty == "commandblind" || sProperty == "commandbool" || sProperty == "commandstring") {
+            alpacaError(jResp, ALPACA_NOT_IMPLEMENTED, "not implemented");
+        }
+        else {
+            sendResponse(Client, "400 Bad Request", "text/plain", "", "unknown method\n", false);
+            return;
+        }
+        sendResponse(Client, "200 OK", "application/json", "", jResp.dump(), false);
+        return;
+    }
+
+    if(sProperty == "connected")
+        jResp["Value"] = m_bAlpacaConnected;
+    else if(sProperty == "name")
+        jResp["Value"] = "WeatherEagle";
+    else if(sProperty == "description")
+        jResp["Value"] = "Weather Eagle " + m_pDevice->getDeviceTag();
+    else if(sProperty == "driverinfo")
+        jResp["Value"] = "X2 WeatherEagle plugin, cached readings";
+    else if(sProperty == "driverversion")
+        jResp["Value"] = m_szVersion;
+    else if(sProperty == "interfaceversion")
+        jResp["Value"] = ALPACA_INTERFACE_VERSION;
+    else if(sProperty == "supportedactions")
+        jResp["Value"] = json::array();
+    else if(sProperty == "averageperiod")
+        jResp["Value"] = 0.0;
+    else if(sProperty == "temperature" || sProperty == "humidity" || sProperty == "dewpoint" || sProperty == "pressure" ||
+            sProperty == "timesincelastupdate" || sProperty == "sensordescription") {
+        sSensor = alpacaParam(sParams, "SensorName");
+        std::transform(sSensor.begin(), sSensor.end(), sSensor.begin(), [](unsigned char c) { return char(tolower(c)); });
+        if(!m_bAlpacaConnected)
+            alpacaError(jResp, ALPACA_NOT_CONNECTED, "not connected");
+        else if(!sSensor.empty() && sSensor != "temperature" && sSensor != "humidity" && sSensor != "dewpoint" && sSensor != "pressure")
+            alpacaError(jResp, ALPACA_NOT_IMPLEMENTED, "the Eagle has no such sensor");
+        else if(sProperty == "sensordescription")   // no sensor name, the device itself
+            jResp["Value"] = "Weather Eagle " + (sSensor.empty() ? m_pDevice->getDeviceTag() : sSensor);
+        else if(!pHttp)
+            alpacaError(jResp, ALPACA_VALUE_NOT_SET, "no reading yet");
+        else if(sProperty == "temperature")
+            jResp["Value"] = pHttp->Snapshot.dTemp;
+        else if(sProperty == "humidity")
+            jResp["Value"] = pHttp->Snapshot.dPercentHumdity;
+        else if(sProperty == "dewpoint")
+            jResp["Value"] = pHttp->Snapshot.dDewPointTemp;
+        else if(sProperty == "pressure")
+            jResp["Value"] = pHttp->Snapshot.dBarometricPressure;
+        else {
+            nNowMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+            jResp["Value"] = std::max<int64_t>(nNowMs - pHttp->nTimestampMs, 0) / 1000.0;
+        }
+    }
+    else {
+        sendResponse(Client, "400 Bad Request", "text/plain", "", "unknown method\n", false);
+        return;
+    }
+    sendResponse(Client, "200 OK", "application/json", "", jResp.dump(), false);
+}
+
+void CEagleHttpServer::alpacaError(json &jResp, int nError, const char *pszMessage)
+{
+    jResp["ErrorNumber"] = nError;
+    jResp["ErrorMessage"] = pszMessage;
+}
+
+// Alpaca parameter names are case insensitive, values are form encoded
+std::string CEagleHttpServer::alpacaParam(const std::string &sParams, const char *pszName)
+{
+    size_t nPos = 0;
+    size_t nEnd;
+    size_t nEqual;
+    size_t nNameLen = strlen(pszName);
+    std::string sValue;
+
+    while(nPos <= sParams.size()) {
+        nEnd = sParams.find('&', nPos);
+        if(nEnd == std::string::npos)
+            nEnd = sParams.size();
+        nEqual = sParams.find('=', nPos);
+        if(nEqual != std::string::npos && nEqual < nEnd && nEqual - nPos == nNameLen &&
+           strncasecmp(sParams.c_str() + nPos, pszName, nNameLen) == 0) {
+            for(size_t i = nEqual + 1; i < nEnd; i++) {
+                if(sParams[i] == '+')
+                    sValue += ' ';
+                else if(sParams[i] == '%' && i + 2 < nEnd + 1 && isxdigit((unsigned char)sParams[i+1]) && isxdigit((unsigned char)sParams[i+2])) {
+                    sValue += char(strtol(sParams.substr(i + 1, 2).c_str(), NULL, 16));
+                    i += 2;
+                }
+                else
+                    sValue += sParams[i];
+            }
+            return sValue;
+        }
+        nPos = nEnd + 1;
+    }
+    return sValue;
+}
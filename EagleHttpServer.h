@@ -0,0 +1,134 @@
+//
+//  EagleHttpServer.h
+//  CEagleHttpServer
+//
+//  WeatherEagle X2 plugin
+//
+//  Small HTTP/1.1 server answering from the cached snapshot, so local tools
+//  never hit the Eagle's own web server. The JSON body is serialized once per
+//  publish and the session id plus sample sequence is used as ETag, unchanged
+//  data costs a 304.
+//  /events is a server-sent events stream of the fields that changed in each
+//  snapshot, one shared buffer per update whatever the number of subscribers.
+//  When enabled it also answers the ASCOM Alpaca ObservingConditions API
+//  (device 0) from the same cached snapshot.
+
+#ifndef __EagleHttpServer__
+#define __EagleHttpServer__
+
+#include "EagleSocket.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+
+#include "EagleSinks.h"
+
+#define HTTP_MAX_CLIENTS        32
+#define HTTP_MAX_REQUEST_SIZE   8192
+#define HTTP_IDLE_TIMEOUT_MS    30000   // keep alive connections are closed after this
+#define HTTP_LISTEN_BACKLOG     16
+
+#define SSE_MAX_QUEUE           8       // events queued per subscriber before it is resynced
+#define SSE_HEARTBEAT_MS        15000   // comment line sent to idle subscribers
+
+#define ALPACA_DEFAULT_PORT     11111
+#define ALPACA_INTERFACE_VERSION 1
+// Alpaca error numbers
+#define ALPACA_NOT_IMPLEMENTED  0x400
+#define ALPACA_INVALID_VALUE    0x401
+#define ALPACA_VALUE_NOT_SET    0x402
+#define ALPACA_NOT_CONNECTED    0x407
+
+class CEagleHttpServer : public CSnapshotSink
+{
+public:
+    CEagleHttpServer(const std::string &sBindAddress, int nPort, bool bAlpaca);
+    ~CEagleHttpServer();
+
+    bool start(CWeatherEagle *pDevice);
+    void stop();
+    void publish(const WeatherEagleSnapshot &Snapshot);
+
+    uint64_t getDroppedEvents() { return m_nDroppedEvents; }
+
+private:
+    typedef std::shared_ptr<const std::string> SharedBuffer;
+
+    // everything a request needs, rebuilt on each publish and swapped atomically
+    typedef struct {
+        int64_t     nTimestampMs;   // steady clock, for the age
+        WeatherEagleSnapshot Snapshot;  // raw values for the Alpaca api
+        std::string sEtag;          // quoted
+        std::string sBodyTail;      // serialized snapshot, spliced after the age
+    } HttpSnapshot;
+
+    typedef struct {
+        eagle_socket_t  fd;
+        std::string     sIn;
+        std::string     sOut;
+        size_t          nOutPos;
+        bool            bClose;         // close once sOut is flushed
+        bool            bStream;        // /events subscriber
+        std::deque<SharedBuffer> qEvents;   // sent after sOut, bounded by SSE_MAX_QUEUE
+        size_t          nEventPos;      // bytes of qEvents.front() already sent
+        std::chrono::steady_clock::time_point tLastActivity;
+    } HttpClient;
+
+    void    run();
+    void    acceptClients();
+    bool    readClient(HttpClient &Client);
+    bool    writeClient(HttpClient &Client);
+    bool    hasPendingOutput(const HttpClient &Client);
+    void    handleRequest(HttpClient &Client, const std::string &sRequest, const std::string &sBody);
+    void    serveSnapshot(HttpClient &Client, const std::string &sIfNoneMatch, bool bHead);
+    void    serveEvents(HttpClient &Client, bool bHead);
+    void    dispatchEvents();
+    void    enqueueEvent(HttpClient &Client, const SharedBuffer &pEvent);
+    void    resyncClient(HttpClient &Client);
+    void    sendResponse(HttpClient &Client, const char *pszStatus, const char *pszContentType,
+                         const std::string &sExtraHeaders, const std::string &sBody, bool bHead);
+    void    closeClient(HttpClient &Client);
+
+    // Alpaca
+    void    serveAlpaca(HttpClient &Client, bool bPut, const std::string &sPath, const std::string &sParams);
+    void    serveAlpacaDevice(HttpClient &Client, bool bPut, const std::string &sProperty, const std::string &sParams, json &jResp);
+    void    alpacaError(json &jResp, int nError, const char *pszMessage);
+    static std::string alpacaParam(const std::string &sParams, const char *pszName);
+
+    static std::string  headerValue(const std::string &sRequest, const char *pszName);
+
+    std::string                     m_sBindAddress;
+    int                             m_nPort;
+    CWeatherEagle                   *m_pDevice;
+    bool                            m_bAlpaca;
+    bool                            m_bAlpacaConnected;     // server thread only
+    char                            m_szVersion[16];        // PLUGIN_VERSION as x.yy
+    uint32_t                        m_nServerTransactionID; // server thread only
+
+    std::shared_ptr<const HttpSnapshot> m_pSnapshot;    // std::atomic_load/atomic_store only
+
+    // event stream, the publisher only appends here and wakes the server thread
+    json                            m_jPrevious;        // last published snapshot, publisher thread only
+    uint64_t                        m_nSessionId;       // start wall time, in the etag and event id
+    uint64_t                        m_nLastSeq;         // publisher thread only
+    SharedBuffer                    m_pFullEvent;       // std::atomic_load/atomic_store only
+    std::mutex                      m_EventMutex;
+    std::vector<SharedBuffer>       m_vPendingEvents;
+    bool                            m_bResyncAll;       // pending events overflowed
+    std::atomic<uint64_t>           m_nDroppedEvents;
+
+    std::thread                     m_th;
+    std::atomic<bool>               m_bRunning;
+    eagle_socket_t                  m_Listen;
+    eagle_socket_t                  m_Wake;             // see eagleOpenWakeSocket
+    std::vector<HttpClient>         m_vClients;         // owned by the server thread
+};
+
+#endif
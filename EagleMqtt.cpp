@@ -0,0 +1,382 @@
+//
+//  EagleMqtt.cpp
+//  CMqttSink
+//
+//  WeatherEagle X2 plugin
+
+#include "EagleMqtt.h"
+
+#include <math.h>
+
+// control packet types
+#define MQTT_CONNECT        0x10
+#define MQTT_CONNACK        0x20
+#define MQTT_PUBLISH_RETAIN 0x31    // QoS 0, retain
+#define MQTT_PINGREQ        0xC0
+#define MQTT_DISCONNECT     0xE0
+
+// published fields, in WeatherEagleFields order, and their wire deadbands in snapshot units
+const CMqttSink::MqttField CMqttSink::m_Fields[] = {
+    {"temperature",     offsetof(WeatherEagleSnapshot, dTemp),                              0.1},
+    {"humidity",        offsetof(WeatherEagleSnapshot, dPercentHumdity),                    1.0},
+    {"dewpoint",        offsetof(WeatherEagleSnapshot, dDewPointTemp),                      0.1},
+    {"pressure",        offsetof(WeatherEagleSnapshot, dBarometricPressure),                0.5},
+    {"temperature5",    offsetof(WeatherEagleSnapshot, dExtTemp) + 0 * sizeof(double),      0.1},
+    {"temperature6",    offsetof(WeatherEagleSnapshot, dExtTemp) + 1 * sizeof(double),      0.1},
+    {"temperature7",    offsetof(WeatherEagleSnapshot, dExtTemp) + 2 * sizeof(double),      0.1},
+};
+
+#define MQTT_FIELD_COUNT    (sizeof(m_Fields) / sizeof(m_Fields[0]))
+
+CMqttSink::CMqttSink(const std::string &sHost, int nPort, const std::string &sPrefix,
+                     const std::string &sUser, const std::string &sPassword)
+{
+    m_sHost = sHost;
+    m_nPort = nPort > 0 ? nPort : MQTT_DEFAULT_PORT;
+    m_sPrefix = sPrefix.empty() ? MQTT_DEFAULT_PREFIX : sPrefix;
+    m_sUser = sUser;
+    m_sPassword = sPassword;
+    m_bRunning = false;
+    m_Wake = EAGLE_INVALID_SOCKET;
+    m_Socket = EAGLE_INVALID_SOCKET;
+    m_nState = MQTT_DISCONNECTED;
+    m_bTcpConnected = false;
+    m_nOutPos = 0;
+    m_nRetryMs = MQTT_RETRY_MIN_MS;
+    m_nPublished = 0;
+    m_nReconnects = 0;
+}
+
+CMqttSink::~CMqttSink()
+{
+    stop();
+}
+
+bool CMqttSink::start(CWeatherEagle *pDevice)
+{
+    std::string sBase;
+
+    if(m_bRunning)
+        return true;
+    if(m_sHost.empty() || !eagleSocketStartup())
+        return false;
+
+    m_Wake = eagleOpenWakeSocket();
+    if(m_Wake == EAGLE_INVALID_SOCKET) {
+        eagleSocketCleanup();
+        return false;
+    }
+
+    sBase = m_sPrefix + "/" + pDevice->getDeviceTag() + "/";
+    m_sStatusTopic = sBase + "status";
+    m_sClientId = ("X2Eagle-" + pDevice->getDeviceTag()).substr(0, MQTT_CLIENT_ID_SIZE);
+    m_Topics.resize(MQTT_FIELD_COUNT);
+    for(size_t i = 0; i < MQTT_FIELD_COUNT; i++) {
+        m_Topics[i].sTopic = sBase + m_Fields[i].pszName;
+        m_Topics[i].bValid = false;
+        m_Topics[i].bDirty = false;
+        m_Topics[i].dValue = 0.0;
+    }
+
+    m_tRetryAt = std::chrono::steady_clock::now();
+    m_bRunning = true;
+    m_th = std::thread(&CMqttSink::run, this);
+    return true;
+}
+
+void CMqttSink::stop()
+{
+    if(!m_bRunning)
+        return;
+
+    m_bRunning = false;
+    eagleWake(m_Wake);
+    if(m_th.joinable())
+        m_th.join();
+    eagleCloseSocket(m_Wake);
+    m_Wake = EAGLE_INVALID_SOCKET;
+    eagleSocketCleanup();
+}
+
+// poller thread, only touches the topic table
+void CMqttSink::publish(const WeatherEagleSnapshot &Snapshot)
+{
+    char szPayload[32];
+    double dValue;
+    bool bChanged = false;
+
+    // retained messages must be current, don't push last session's values
+    if(Snapshot.nFlags & SNAPSHOT_FLAG_WARM_START)
+        return;
+    // nothing moved past the device deadbands
+    if(!Snapshot.nChangedFields)
+        return;
+
+    {
+        const std::lock_guard<std::mutex> lock(m_Mutex);
+        for(size_t i = 0; i < m_Topics.size(); i++) {
+            MqttTopic &Topic = m_Topics[i];
+            if(!(Snapshot.nChangedFields & (1 << i)))
+                continue;
+            memcpy(&dValue, (const char *)&Snapshot + m_Fields[i].nOffset, sizeof(double));
+            if(Topic.bValid && fabs(dValue - Topic.dValue) < m_Fields[i].dDeadband)
+                continue;
+            snprintf(szPayload, sizeof(szPayload), "%.2f", dValue);
+            Topic.sPayload = szPayload;
+            Topic.dValue = dValue;
+            Topic.bValid = true;
+            Topic.bDirty = true;
+            bChanged = true;
+        }
+    }
+    if(bChanged)
+        eagleWake(m_Wake);
+}
+
+void CMqttSink::run()
+{
+    struct pollfd Fds[2];
+    std::chrono::steady_clock::time_point tNow;
+    int nFds;
+    int nTimeoutMs;
+    int nErr;
+    socklen_t nErrLen;
+
+    while(m_bRunning) {
+        tNow = std::chrono::steady_clock::now();
+
+        if(m_nState == MQTT_DISCONNECTED && tNow >= m_tRetryAt && !openConnection())
+            closeConnection(true);
+
+        if(m_nState == MQTT_CONNECTING &&
+           std::chrono::duration_cast<std::chrono::milliseconds>(tNow - m_tConnectStart).count() > MQTT_CONNECT_TIMEOUT_MS)
+            closeConnection(true);
+
+        if(m_nState == MQTT_CONNECTED) {
+            queueDirtyTopics(false);
+            if(std::chrono::duration_cast<std::chrono::seconds>(tNow - m_tLastRx).count() > MQTT_KEEPALIVE_S * 3 / 2) {
+                closeConnection(true);  // broker gone silent
+            }
+            else if(std::chrono::duration_cast<std::chrono::seconds>(tNow - m_tLastTx).count() >= MQTT_KEEPALIVE_S / 2) {
+                m_sOut.push_back(char(MQTT_PINGREQ));
+                m_sOut.push_back(0);
+            }
+        }
+        if(m_nState != MQTT_DISCONNECTED && m_sOut.size() - m_nOutPos > MQTT_MAX_OUTBOUND)
+            closeConnection(true);      // broker not reading, drop it rather than grow
+        if(m_nState != MQTT_DISCONNECTED && m_bTcpConnected && m_nOutPos < m_sOut.size() && !flushOutbound())
+            closeConnection(true);
+
+        nFds = 0;
+        Fds[nFds++] = {m_Wake, POLLIN, 0};
+        if(m_nState != MQTT_DISCONNECTED) {
+            short nEvents = POLLIN;
+            if(!m_bTcpConnected || m_nOutPos < m_sOut.size())
+                nEvents |= POLLOUT;
+            Fds[nFds++] = {m_Socket, nEvents, 0};
+        }
+
+        nTimeoutMs = 1000;
+        if(m_nState == MQTT_DISCONNECTED)
+            nTimeoutMs = int(std::max<int64_t>(0, std::min<int64_t>(nTimeoutMs,
+                             std::chrono::duration_cast<std::chrono::milliseconds>(m_tRetryAt - tNow).count())));
+        if(eagle_poll(Fds, (unsigned long)nFds, nTimeoutMs) < 0)
+            continue;
+
+        if(Fds[0].revents & POLLIN)
+            eagleDrainWake(m_Wake);
+        if(nFds < 2 || !Fds[1].revents)
+            continue;
+
+        if(!m_bTcpConnected && (Fds[1].revents & (POLLOUT | POLLERR | POLLHUP))) {
+            nErr = 0;
+            nErrLen = sizeof(nErr);
+            getsockopt(m_Socket, SOL_SOCKET, SO_ERROR, (char *)&nErr, &nErrLen);
+            if(nErr) {
+                closeConnection(true);
+                continue;
+            }
+            m_bTcpConnected = true;
+        }
+        if((Fds[1].revents & (POLLIN | POLLHUP | POLLERR)) && !readInbound())
+            closeConnection(true);
+    }
+
+    // clean shutdown, the will is only for crashes and network loss
+    if(m_nState == MQTT_CONNECTED) {
+        encodePublish(m_sOut, m_sStatusTopic, "offline");
+        m_sOut.push_back(char(MQTT_DISCONNECT));
+        m_sOut.push_back(0);
+        flushOutbound();
+    }
+    closeConnection(false);
+}
+
+// starts a non blocking connect and queues the CONNECT packet
+bool CMqttSink::openConnection()
+{
+    struct addrinfo Hints;
+    struct addrinfo *pResult = nullptr;
+    std::string sBody;
+    uint8_t nFlags;
+    bool bOk = false;
+    int nOn = 1;
+
+    memset(&Hints, 0, sizeof(Hints));
+    Hints.ai_family = AF_UNSPEC;
+    Hints.ai_socktype = SOCK_STREAM;
+    if(getaddrinfo(m_sHost.c_str(), std::to_string(m_nPort).c_str(), &Hints, &pResult) != 0 || !pResult)
+        return false;
+
+    m_Socket = socket(pResult->ai_family, pResult->ai_socktype, pResult->ai_protocol);
+    if(m_Socket != EAGLE_INVALID_SOCKET) {
+        eagleSetNonBlocking(m_Socket);
+        eagleSetNoSigPipe(m_Socket);
+        setsockopt(m_Socket, IPPROTO_TCP, TCP_NODELAY, (const char *)&nOn, sizeof(nOn));
+        bOk = connect(m_Socket, pResult->ai_addr, (socklen_t)pResult->ai_addrlen) == 0 || eagleWouldBlock();
+    }
+    freeaddrinfo(pResult);
+    if(!bOk)
+        return false;
+
+    m_nReconnects++;
+    m_nState = MQTT_CONNECTING;
+    m_bTcpConnected = false;
+    m_tConnectStart = std::chrono::steady_clock::now();
+    m_tLastTx = m_tConnectStart;
+    m_tLastRx = m_tConnectStart;
+    m_sIn.clear();
+    m_sOut.clear();
+    m_nOutPos = 0;
+
+    // clean session, retained will on the status topic
+    nFlags = 0x02 | 0x04 | 0x20;
+    if(!m_sUser.empty())
+        nFlags |= 0x80;
+    // 3.1.1 doesn't allow a password without a user name [MQTT-3.1.2-22]
+    if(!m_sUser.empty() && !m_sPassword.empty())
+        nFlags |= 0x40;
+    encodeString(sBody, "MQTT");
+    sBody.push_back(4);                         // protocol level 3.1.1
+    sBody.push_back(char(nFlags));
+    sBody.push_back(char(MQTT_KEEPALIVE_S >> 8));
+    sBody.push_back(char(MQTT_KEEPALIVE_S & 0xFF));
+    encodeString(sBody, m_sClientId);
+    encodeString(sBody, m_sStatusTopic);
+    encodeString(sBody, "offline");
+    if(!m_sUser.empty())
+        encodeString(sBody, m_sUser);
+    if(nFlags & 0x40)
+        encodeString(sBody, m_sPassword);
+
+    m_sOut.push_back(char(MQTT_CONNECT));
+    encodeRemainingLength(m_sOut, sBody.size());
+    m_sOut.append(sBody);
+    return true;
+}
+
+void CMqttSink::closeConnection(bool bRetryLater)
+{
+    eagleCloseSocket(m_Socket);
+    m_Socket = EAGLE_INVALID_SOCKET;
+    m_bTcpConnected = false;
+    m_sOut.clear();
+    m_nOutPos = 0;
+    m_sIn.clear();
+
+    if(bRetryLater) {
+        if(m_nState == MQTT_CONNECTED)
+            m_nRetryMs = MQTT_RETRY_MIN_MS;    // was working, try again soon
+        else
+            m_nRetryMs = std::min(m_nRetryMs * 2, MQTT_RETRY_MAX_MS);
+        m_tRetryAt = std::chrono::steady_clock::now() + std::chrono::milliseconds(m_nRetryMs);
+    }
+    m_nState = MQTT_DISCONNECTED;
+}
+
+// all the pending packets go out in as few send() calls as the socket allows
+bool CMqttSink::flushOutbound()
+{
+    long nSent;
+
+    while(m_nOutPos < m_sOut.size()) {
+        nSent = send(m_Socket, m_sOut.data() + m_nOutPos, m_sOut.size() - m_nOutPos, EAGLE_SEND_FLAGS);
+        if(nSent < 0)
+            return eagleWouldBlock();
+        m_nOutPos += size_t(nSent);
+        m_tLastTx = std::chrono::steady_clock::now();
+    }
+    m_sOut.clear();
+    m_nOutPos = 0;
+    return true;
+}
+
+// we only publish, the broker sends CONNACK and PINGRESP, anything else is skipped
+bool CMqttSink::readInbound()
+{
+    char szBuffer[512];
+    long nRead;
+
+    nRead = recv(m_Socket, szBuffer, sizeof(szBuffer), 0);
+    if(nRead == 0)
+        return false;
+    if(nRead < 0)
+        return eagleWouldBlock();
+    m_tLastRx = std::chrono::steady_clock::now();
+
+    if(m_nState != MQTT_CONNECTING)
+        return true;
+
+    m_sIn.append(szBuffer, size_t(nRead));
+    if(m_sIn.size() < 4)
+        return true;
+    if(uint8_t(m_sIn[0]) != MQTT_CONNACK || m_sIn[3] != 0)
+        return false;   // refused (bad credentials, client id...)
+
+    m_nState = MQTT_CONNECTED;
+    m_nRetryMs = MQTT_RETRY_MIN_MS;
+    m_sIn.clear();
+    // new session, bring the retained values up to date
+    encodePublish(m_sOut, m_sStatusTopic, "online");
+    queueDirtyTopics(true);
+    return true;
+}
+
+void CMqttSink::queueDirtyTopics(bool bAll)
+{
+    const std::lock_guard<std::mutex> lock(m_Mutex);
+
+    for(MqttTopic &Topic : m_Topics) {
+        if(!Topic.bValid || !(Topic.bDirty || bAll))
+            continue;
+        encodePublish(m_sOut, Topic.sTopic, Topic.sPayload);
+        Topic.bDirty = false;
+        m_nPublished++;
+    }
+}
+
+void CMqttSink::encodeRemainingLength(std::string &sPacket, size_t nLength)
+{
+    do {
+        uint8_t nByte = nLength % 128;
+        nLength /= 128;
+        if(nLength)
+            nByte |= 0x80;
+        sPacket.push_back(char(nByte));
+    } while(nLength);
+}
+
+void CMqttSink::encodeString(std::string &sPacket, const std::string &sString)
+{
+    sPacket.push_back(char((sString.size() >> 8) & 0xFF));
+    sPacket.push_back(char(sString.size() & 0xFF));
+    sPacket.append(sString);
+}
+
+void CMqttSink::encodePublish(std::string &sPacket, const std::string &sTopic, const std::string &sPayload)
+{
+    sPacket.push_back(char(MQTT_PUBLISH_RETAIN));
+    encodeRemainingLength(sPacket, 2 + sTopic.size() + sPayload.size());
+    encodeString(sPacket, sTopic);
+    sPacket.append(sPayload);
+}
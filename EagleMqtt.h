@@ -0,0 +1,114 @@
+//
+//  EagleMqtt.h
+//  CMqttSink
+//
+//  WeatherEagle X2 plugin
+//
+//  Minimal MQTT 3.1.1 publisher, QoS 0 retained messages only.
+//  One retained topic per reading, <prefix>/<device>/<field>, published only
+//  when the value moves by more than the field deadband. The client runs on its
+//  own thread, the poller only updates a small per topic table and never
+//  waits on the broker.
+
+#ifndef __EagleMqtt__
+#define __EagleMqtt__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+
+#include "EagleSocket.h"
+#include "EagleSinks.h"
+
+#define MQTT_DEFAULT_PORT           1883
+#define MQTT_DEFAULT_PREFIX         "weathereagle"
+#define MQTT_KEEPALIVE_S            30
+#define MQTT_CONNECT_TIMEOUT_MS     3000
+#define MQTT_RETRY_MIN_MS           1000    // reconnect backoff
+#define MQTT_RETRY_MAX_MS           60000
+#define MQTT_MAX_OUTBOUND           65536   // unsent bytes before the broker is considered stuck
+#define MQTT_CLIENT_ID_SIZE         23      // 3.1.1 limit
+
+enum MqttState {MQTT_DISCONNECTED=0, MQTT_CONNECTING, MQTT_CONNECTED};
+
+class CMqttSink : public CSnapshotSink
+{
+public:
+    CMqttSink(const std::string &sHost, int nPort, const std::string &sPrefix,
+              const std::string &sUser, const std::string &sPassword);
+    ~CMqttSink();
+
+    bool start(CWeatherEagle *pDevice);
+    void stop();
+    void publish(const WeatherEagleSnapshot &Snapshot);
+
+    int         getState() { return m_nState; }
+    uint64_t    getPublished() { return m_nPublished; }
+    uint64_t    getReconnects() { return m_nReconnects; }
+
+private:
+    typedef struct {
+        const char  *pszName;
+        size_t      nOffset;        // double in WeatherEagleSnapshot
+        double      dDeadband;
+    } MqttField;
+
+    typedef struct {
+        std::string sTopic;
+        std::string sPayload;
+        double      dValue;         // last value queued, the deadband reference
+        bool        bValid;
+        bool        bDirty;         // changed since last sent
+    } MqttTopic;
+
+    void    run();
+    bool    openConnection();
+    void    closeConnection(bool bRetryLater);
+    bool    flushOutbound();
+    bool    readInbound();
+    void    queueDirtyTopics(bool bAll);
+
+    static void encodeRemainingLength(std::string &sPacket, size_t nLength);
+    static void encodeString(std::string &sPacket, const std::string &sString);
+    static void encodePublish(std::string &sPacket, const std::string &sTopic, const std::string &sPayload);
+
+    static const MqttField  m_Fields[];
+
+    std::string             m_sHost;
+    int                     m_nPort;
+    std::string             m_sPrefix;
+    std::string             m_sUser;
+    std::string             m_sPassword;
+    std::string             m_sClientId;
+    std::string             m_sStatusTopic;
+
+    // topic table, written by publish, read by the client thread
+    std::mutex              m_Mutex;
+    std::vector<MqttTopic>  m_Topics;   // one per m_Fields entry
+
+    std::thread             m_th;
+    std::atomic<bool>       m_bRunning;
+    eagle_socket_t          m_Wake;
+
+    // client thread only
+    eagle_socket_t          m_Socket;
+    std::atomic<int>        m_nState;
+    bool                    m_bTcpConnected;
+    std::string             m_sOut;
+    size_t                  m_nOutPos;
+    std::string             m_sIn;
+    int                     m_nRetryMs;
+    std::chrono::steady_clock::time_point m_tRetryAt;
+    std::chrono::steady_clock::time_point m_tConnectStart;
+    std::chrono::steady_clock::time_point m_tLastTx;
+    std::chrono::steady_clock::time_point m_tLastRx;
+
+    std::atomic<uint64_t>   m_nPublished;
+    std::atomic<uint64_t>   m_nReconnects;
+};
+
+#endif
@@ -0,0 +1,274 @@
+//
+//  EaglePipeline.cpp
+//  CEaglePipeline
+//
+//  WeatherEagle X2 plugin
+
+#include "EaglePipeline.h"
+#include "EagleSinks.h"
+
+static std::mutex s_PipelineLifecycleMutex;
+
+CEaglePipeline& CEaglePipeline::instance()
+{
+    static CEaglePipeline Pipeline;
+    return Pipeline;
+}
+
+CEaglePipeline::CEaglePipeline()
+{
+    m_nDeviceCount = 0;
+    m_bRunning = false;
+    m_nNextSinkWorker = 0;
+
+    m_ParseSignal.bWaiting = false;
+    m_DeriveSignal.bWaiting = false;
+    for(int i = 0; i < PIPELINE_SINK_WORKERS; i++)
+        m_SinkSignals[i].bWaiting = false;
+    for(int i = 0; i < STAGE_COUNT; i++) {
+        m_Counters[i].nProcessed = 0;
+        m_Counters[i].nDropped = 0;
+        m_Counters[i].nMaxDepth = 0;
+        m_Counters[i].nLatencyUs = 0;
+        m_Counters[i].nMaxLatencyUs = 0;
+    }
+}
+
+CEaglePipeline::~CEaglePipeline()
+{
+    // all devices should be gone by now, but don't leave threads running on unload
+    if(m_bRunning) {
+        m_bRunning = false;
+        signal(m_ParseSignal);
+        signal(m_DeriveSignal);
+        for(int i = 0; i < PIPELINE_SINK_WORKERS; i++)
+            signal(m_SinkSignals[i]);
+        for(auto &th : m_vThreads)
+            if(th.joinable())
+                th.join();
+    }
+}
+
+void CEaglePipeline::addDevice(CWeatherEagle *pDevice)
+{
+    const std::lock_guard<std::mutex> lock(s_PipelineLifecycleMutex);
+
+    pDevice->m_nPipelineInFlight = 0;
+    if(m_nDeviceCount++ > 0)
+        return;
+
+    m_bRunning = true;
+    m_vThreads.emplace_back(&CEaglePipeline::runParse, this);
+    m_vThreads.emplace_back(&CEaglePipeline::runDerive, this);
+    for(int i = 0; i < PIPELINE_SINK_WORKERS; i++)
+        m_vThreads.emplace_back(&CEaglePipeline::runSinkWorker, this, i);
+}
+
+void CEaglePipeline::removeDevice(CWeatherEagle *pDevice)
+{
+    const std::lock_guard<std::mutex> lock(s_PipelineLifecycleMutex);
+
+    if(m_nDeviceCount == 0)
+        return;
+
+    {
+        // nothing new can come in for this device, let what's queued go through
+        std::unique_lock<std::mutex> drain(m_DrainMutex);
+        m_DrainCv.wait(drain, [pDevice]{ return pDevice->m_nPipelineInFlight == 0; });
+    }
+
+    // last device gone, no need to keep the threads around
+    if(--m_nDeviceCount == 0) {
+        m_bRunning = false;
+        signal(m_ParseSignal);
+        signal(m_DeriveSignal);
+        for(int i = 0; i < PIPELINE_SINK_WORKERS; i++)
+            signal(m_SinkSignals[i]);
+        for(auto &th : m_vThreads)
+            th.join();
+        m_vThreads.clear();
+    }
+}
+
+bool CEaglePipeline::submit(CWeatherEagle *pDevice, std::string &sResponse)
+{
+    FetchedSample Sample;
+
+    Sample.pDevice = pDevice;
+    Sample.sResponse.swap(sResponse);
+    Sample.tQueued = std::chrono::steady_clock::now();
+
+    pDevice->m_nPipelineInFlight++;
+    if(!m_ParseQueue.push(Sample)) {
+        m_Counters[STAGE_PARSE].nDropped++;
+        pDevice->m_nPipelineInFlight--;
+        return false;
+    }
+    recordDepth(STAGE_PARSE, m_ParseQueue.size());
+    signal(m_ParseSignal);
+    return true;
+}
+
+void CEaglePipeline::getMetrics(PipelineMetrics &Metrics)
+{
+    size_t nSinkDepth = 0;
+
+    for(int i = 0; i < PIPELINE_SINK_WORKERS; i++)
+        nSinkDepth += m_SinkQueues[i].size();
+
+    for(int i = 0; i < STAGE_COUNT; i++) {
+        Metrics.Stages[i].nProcessed = m_Counters[i].nProcessed;
+        Metrics.Stages[i].nDropped = m_Counters[i].nDropped;
+        Metrics.Stages[i].nMaxDepth = m_Counters[i].nMaxDepth;
+        Metrics.Stages[i].nLatencyUs = m_Counters[i].nLatencyUs;
+        Metrics.Stages[i].nMaxLatencyUs = m_Counters[i].nMaxLatencyUs;
+    }
+    Metrics.Stages[STAGE_PARSE].nDepth = int(m_ParseQueue.size());
+    Metrics.Stages[STAGE_DERIVE].nDepth = int(m_DeriveQueue.size());
+    Metrics.Stages[STAGE_SINKS].nDepth = int(nSinkDepth);
+}
+
+#pragma mark - stages
+
+// parse and validate the /getecco response
+void CEaglePipeline::runParse()
+{
+    FetchedSample Sample;
+    ParsedSample Parsed;
+
+    while(m_bRunning) {
+        if(!m_ParseQueue.pop(Sample)) {
+            waitFor(m_ParseSignal, m_ParseQueue);
+            continue;
+        }
+
+        Parsed.pDevice = Sample.pDevice;
+        if(Sample.pDevice->parseEccoResponse(Sample.pDevice->cleanupResponse(Sample.sResponse, '\n'), Parsed.Snapshot) != PLUGIN_OK) {
+            // nothing to publish, let the on demand readers go
+            recordDone(STAGE_PARSE, Sample.tQueued);
+            Sample.pDevice->refreshCompleted();
+            sampleDone(Sample.pDevice, 1);
+            continue;
+        }
+        recordDone(STAGE_PARSE, Sample.tQueued);
+
+        Parsed.tQueued = std::chrono::steady_clock::now();
+        if(!m_DeriveQueue.push(Parsed)) {
+            m_Counters[STAGE_DERIVE].nDropped++;
+            Sample.pDevice->refreshCompleted();
+            sampleDone(Sample.pDevice, 1);
+            continue;
+        }
+        recordDepth(STAGE_DERIVE, m_DeriveQueue.size());
+        signal(m_DeriveSignal);
+    }
+}
+
+// stamp and publish the sample, then fan it out to the device sinks
+void CEaglePipeline::runDerive()
+{
+    ParsedSample Parsed;
+    SinkJob Job;
+    std::vector<std::shared_ptr<CSnapshotSink>> vSinks;
+    int nWorker;
+    int nJobs;
+
+    while(m_bRunning) {
+        if(!m_DeriveQueue.pop(Parsed)) {
+            waitFor(m_DeriveSignal, m_DeriveQueue);
+            continue;
+        }
+
+        Parsed.pDevice->storeSnapshot(Parsed.Snapshot, vSinks);
+        Parsed.pDevice->refreshCompleted();
+        recordDone(STAGE_DERIVE, Parsed.tQueued);
+
+        // count the jobs before queuing them so removeDevice can't see 0 in between
+        Parsed.pDevice->m_nPipelineInFlight += int(vSinks.size());
+        nJobs = 0;
+        for(auto &pSink : vSinks) {
+            Job.pDevice = Parsed.pDevice;
+            Job.pSink = pSink;
+            Job.Snapshot = Parsed.Snapshot;
+            Job.tQueued = std::chrono::steady_clock::now();
+            // same sink, same worker, the sink sees its samples in order
+            nWorker = pSink->getWorker();
+            if(!m_SinkQueues[nWorker].push(Job)) {
+                m_Counters[STAGE_SINKS].nDropped++;
+                continue;
+            }
+            nJobs++;
+            recordDepth(STAGE_SINKS, m_SinkQueues[nWorker].size());
+            signal(m_SinkSignals[nWorker]);
+        }
+        // this sample and the jobs that didn't fit
+        sampleDone(Parsed.pDevice, 1 + int(vSinks.size()) - nJobs);
+        vSinks.clear();
+    }
+}
+
+void CEaglePipeline::runSinkWorker(int nWorker)
+{
+    SinkJob Job;
+
+    while(m_bRunning) {
+        if(!m_SinkQueues[nWorker].pop(Job)) {
+            waitFor(m_SinkSignals[nWorker], m_SinkQueues[nWorker]);
+            continue;
+        }
+        Job.pSink->publish(Job.Snapshot);
+        recordDone(STAGE_SINKS, Job.tQueued);
+        Job.pSink.reset();
+        sampleDone(Job.pDevice, 1);
+    }
+}
+
+#pragma mark - helpers
+
+void CEaglePipeline::signal(StageSignal &Signal)
+{
+    if(!Signal.bWaiting)
+        return;
+    const std::lock_guard<std::mutex> lock(Signal.Mutex);
+    Signal.Cv.notify_one();
+}
+
+template <typename QueueType>
+void CEaglePipeline::waitFor(StageSignal &Signal, QueueType &Queue)
+{
+    std::unique_lock<std::mutex> lock(Signal.Mutex);
+
+    Signal.bWaiting = true;
+    // the timeout covers a push racing with bWaiting being set
+    Signal.Cv.wait_for(lock, std::chrono::milliseconds(PIPELINE_IDLE_WAIT_MS), [this, &Queue]{ return Queue.size() || !m_bRunning; });
+    Signal.bWaiting = false;
+}
+
+void CEaglePipeline::recordDepth(int nStage, size_t nDepth)
+{
+    int nMax = m_Counters[nStage].nMaxDepth;
+    while(int(nDepth) > nMax && !m_Counters[nStage].nMaxDepth.compare_exchange_weak(nMax, int(nDepth)))
+        ;
+}
+
+void CEaglePipeline::recordDone(int nStage, const TimePoint &tQueued)
+{
+    StageCounters &Counters = m_Counters[nStage];
+    int nUs = int(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - tQueued).count());
+    int nMax;
+
+    Counters.nProcessed++;
+    // exponentially weighted, 1/4 of the new sample
+    Counters.nLatencyUs = Counters.nLatencyUs ? (3 * Counters.nLatencyUs + nUs) / 4 : std::max(nUs, 1);
+    nMax = Counters.nMaxLatencyUs;
+    while(nUs > nMax && !Counters.nMaxLatencyUs.compare_exchange_weak(nMax, nUs))
+        ;
+}
+
+void CEaglePipeline::sampleDone(CWeatherEagle *pDevice, int nCount)
+{
+    if((pDevice->m_nPipelineInFlight -= nCount) != 0)
+        return;
+    const std::lock_guard<std::mutex> lock(m_DrainMutex);
+    m_DrainCv.notify_all();
+}
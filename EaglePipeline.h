@@ -0,0 +1,178 @@
+//
+//  EaglePipeline.h
+//  CEaglePipeline
+//
+//  WeatherEagle X2 plugin
+//
+//  Staged processing of the polled samples, shared by all the devices of the process.
+//  fetch (poller thread) -> parse/validate -> derive/publish -> sink workers
+//  Each stage owns its thread and the stages are linked by bounded single producer /
+//  single consumer queues, a full queue drops the sample instead of blocking the
+//  stage before it, so a slow sink can never delay the next poll.
+
+#ifndef __EaglePipeline__
+#define __EaglePipeline__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+#include "WeatherEagle.h"
+
+#define PIPELINE_QUEUE_SIZE     64      // entries per queue, power of two
+#define PIPELINE_SINK_WORKERS   2       // a sink is always served by the same worker
+#define PIPELINE_IDLE_WAIT_MS   100     // consumers re-check their queue at least this often
+
+enum PipelineStages {STAGE_PARSE=0, STAGE_DERIVE, STAGE_SINKS, STAGE_COUNT};
+
+typedef struct {
+    uint64_t    nProcessed;
+    uint64_t    nDropped;       // queue was full
+    int         nDepth;         // entries waiting right now
+    int         nMaxDepth;
+    int         nLatencyUs;     // smoothed, queued to done
+    int         nMaxLatencyUs;
+} PipelineStageMetrics;
+
+typedef struct {
+    PipelineStageMetrics    Stages[STAGE_COUNT];
+} PipelineMetrics;
+
+// Lock free bounded ring, one producer thread and one consumer thread.
+template <typename T, size_t N>
+class CSpscQueue
+{
+    static_assert((N & (N - 1)) == 0, "queue size must be a power of two");
+
+public:
+    CSpscQueue() : m_nHead(0), m_nTail(0) {}
+
+    bool push(T &Item)
+    {
+        size_t nTail = m_nTail.load(std::memory_order_relaxed);
+        if(nTail - m_nHead.load(std::memory_order_acquire) == N)
+            return false;
+        m_Items[nTail & (N - 1)] = std::move(Item);
+        m_nTail.store(nTail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T &Item)
+    {
+        size_t nHead = m_nHead.load(std::memory_order_relaxed);
+        if(nHead == m_nTail.load(std::memory_order_acquire))
+            return false;
+        Item = std::move(m_Items[nHead & (N - 1)]);
+        m_nHead.store(nHead + 1, std::memory_order_release);
+        return true;
+    }
+
+    size_t size() const
+    {
+        return m_nTail.load(std::memory_order_acquire) - m_nHead.load(std::memory_order_acquire);
+    }
+
+private:
+    // head and tail on their own cache lines, the two threads don't share a line
+    alignas(64) std::atomic<size_t> m_nHead;
+    alignas(64) std::atomic<size_t> m_nTail;
+    alignas(64) T                   m_Items[N];
+};
+
+class CEaglePipeline
+{
+public:
+    static CEaglePipeline& instance();
+
+    void    addDevice(CWeatherEagle *pDevice);
+    // waits for the device samples still in flight, call after the poller let go of it
+    void    removeDevice(CWeatherEagle *pDevice);
+
+    // poller thread only, takes the response buffer. False if the sample was dropped.
+    bool    submit(CWeatherEagle *pDevice, std::string &sResponse);
+
+    void    getMetrics(PipelineMetrics &Metrics);
+
+    // round robin worker for a new sink, so one slow sink doesn't hold up all the others
+    int     nextSinkWorker() { return int(m_nNextSinkWorker++ % PIPELINE_SINK_WORKERS); }
+
+private:
+    CEaglePipeline();
+    ~CEaglePipeline();
+    CEaglePipeline(const CEaglePipeline&) = delete;
+    CEaglePipeline& operator=(const CEaglePipeline&) = delete;
+
+    typedef std::chrono::steady_clock::time_point TimePoint;
+
+    typedef struct {
+        CWeatherEagle   *pDevice;
+        std::string     sResponse;
+        TimePoint       tQueued;
+    } FetchedSample;
+
+    typedef struct {
+        CWeatherEagle           *pDevice;
+        WeatherEagleSnapshot    Snapshot;
+        TimePoint               tQueued;
+    } ParsedSample;
+
+    typedef struct {
+        CWeatherEagle                   *pDevice;
+        std::shared_ptr<CSnapshotSink>  pSink;
+        WeatherEagleSnapshot            Snapshot;
+        TimePoint                       tQueued;
+    } SinkJob;
+
+    // consumer side wake up, producers only take the lock when the consumer sleeps
+    typedef struct {
+        std::mutex              Mutex;
+        std::condition_variable Cv;
+        std::atomic<bool>       bWaiting;
+    } StageSignal;
+
+    typedef struct {
+        std::atomic<uint64_t>   nProcessed;
+        std::atomic<uint64_t>   nDropped;
+        std::atomic<int>        nMaxDepth;
+        std::atomic<int>        nLatencyUs;
+        std::atomic<int>        nMaxLatencyUs;
+    } StageCounters;
+
+    void    runParse();
+    void    runDerive();
+    void    runSinkWorker(int nWorker);
+
+    void    signal(StageSignal &Signal);
+    template <typename QueueType>
+    void    waitFor(StageSignal &Signal, QueueType &Queue);
+
+    void    recordDepth(int nStage, size_t nDepth);
+    void    recordDone(int nStage, const TimePoint &tQueued);
+    void    sampleDone(CWeatherEagle *pDevice, int nCount);
+
+    CSpscQueue<FetchedSample, PIPELINE_QUEUE_SIZE>  m_ParseQueue;       // poller -> parse
+    CSpscQueue<ParsedSample, PIPELINE_QUEUE_SIZE>   m_DeriveQueue;      // parse -> derive
+    CSpscQueue<SinkJob, PIPELINE_QUEUE_SIZE>        m_SinkQueues[PIPELINE_SINK_WORKERS];   // derive -> workers
+
+    StageSignal                 m_ParseSignal;
+    StageSignal                 m_DeriveSignal;
+    StageSignal                 m_SinkSignals[PIPELINE_SINK_WORKERS];
+    StageCounters               m_Counters[STAGE_COUNT];
+
+    int                         m_nDeviceCount;     // protected by the lifecycle mutex
+    std::atomic<bool>           m_bRunning;
+    std::atomic<unsigned int>   m_nNextSinkWorker;
+    std::vector<std::thread>    m_vThreads;
+
+    // removeDevice waits here for the device in flight count to drop to 0
+    std::mutex                  m_DrainMutex;
+    std::condition_variable     m_DrainCv;
+};
+
+#endif
@@ -0,0 +1,363 @@
+//
+//  EaglePoller.cpp
+//  CEaglePoller
+//
+//  WeatherEagle X2 plugin
+
+#include "EaglePoller.h"
+#include "WeatherEagle.h"
+
+static std::mutex s_PollerLifecycleMutex;
+
+CEaglePoller& CEaglePoller::instance()
+{
+    static CEaglePoller Poller;
+    return Poller;
+}
+
+CEaglePoller::CEaglePoller()
+{
+    m_nDeviceCount = 0;
+    m_bRunning = false;
+    m_Multi = nullptr;
+    m_nWheelPos = 0;
+    m_nNextGeneration = 1;
+    m_nHedgeBudget = HEDGE_BUDGET_BURST * 100;
+    m_Wheel.resize(POLLER_WHEEL_SLOTS);
+}
+
+CEaglePoller::~CEaglePoller()
+{
+    // all devices should be gone by now, but don't leave a thread running on unload
+    if(m_bRunning) {
+        m_bRunning = false;
+        curl_multi_wakeup(m_Multi);
+        if(m_th.joinable())
+            m_th.join();
+    }
+    if(m_Multi)
+        curl_multi_cleanup(m_Multi);
+}
+
+void CEaglePoller::addDevice(CWeatherEagle *pDevice)
+{
+    PollerCommand Command;
+    const std::lock_guard<std::mutex> lock(s_PollerLifecycleMutex);
+
+    if(m_nDeviceCount == 0) {
+        m_Multi = curl_multi_init();
+        m_nWheelPos = 0;
+        m_tNextTick = std::chrono::steady_clock::now() + std::chrono::milliseconds(POLLER_TICK_MS);
+        m_bRunning = true;
+        m_th = std::thread(&CEaglePoller::run, this);
+    }
+    m_nDeviceCount++;
+
+    Command.nType = CMD_ADD;
+    Command.pDevice = pDevice;
+    sendCommand(Command);
+}
+
+void CEaglePoller::removeDevice(CWeatherEagle *pDevice)
+{
+    PollerCommand Command;
+    const std::lock_guard<std::mutex> lock(s_PollerLifecycleMutex);
+
+    if(m_nDeviceCount == 0)
+        return;
+
+    Command.nType = CMD_REMOVE;
+    Command.pDevice = pDevice;
+    sendCommand(Command);
+
+    // last device gone, no need to keep the thread around
+    if(--m_nDeviceCount == 0) {
+        m_bRunning = false;
+        curl_multi_wakeup(m_Multi);
+        m_th.join();
+        curl_multi_cleanup(m_Multi);
+        m_Multi = nullptr;
+    }
+}
+
+// Ask for an immediate out of cadence poll, never blocks the caller.
+// Returns false if the request could not be queued.
+bool CEaglePoller::refreshDevice(CWeatherEagle *pDevice)
+{
+    std::unique_lock<std::mutex> lifecycle(s_PollerLifecycleMutex, std::try_to_lock);
+
+    if(!lifecycle.owns_lock() || !m_bRunning)
+        return false; // poller is starting or stopping
+
+    {
+        const std::lock_guard<std::mutex> lock(m_CommandMutex);
+        m_vRefresh.push_back(pDevice);
+    }
+    curl_multi_wakeup(m_Multi);
+    return true;
+}
+
+int CEaglePoller::getDeviceCount()
+{
+    const std::lock_guard<std::mutex> lock(s_PollerLifecycleMutex);
+    return m_nDeviceCount;
+}
+
+void CEaglePoller::sendCommand(PollerCommand &Command)
+{
+    std::unique_lock<std::mutex> lock(m_CommandMutex);
+
+    Command.bDone = false;
+    m_Commands.push_back(&Command);
+    curl_multi_wakeup(m_Multi);
+    // the poller thread owns the multi handle, wait for it to apply the change
+    m_CommandDone.wait(lock, [&Command]{ return Command.bDone; });
+}
+
+void CEaglePoller::processCommands()
+{
+    const std::lock_guard<std::mutex> lock(m_CommandMutex);
+
+    for(CWeatherEagle *pDevice : m_vRefresh) {
+        auto it = m_Devices.find(pDevice);
+        if(it == m_Devices.end()) {
+            continue;
+        }
+        if(it->second.pInFlight || it->second.pHedge) {
+            continue; // the running request will satisfy the refresh
+        }
+        // new generation so the pending timer entry is dropped, the regular cadence resumes from this poll
+        it->second.nGeneration = m_nNextGeneration++;
+        if(!startPoll(pDevice))
+            schedule(pDevice, it->second.nGeneration, pDevice->getPollIntervalMs());
+    }
+    m_vRefresh.clear();
+
+    if(m_Commands.empty())
+        return;
+
+    for(PollerCommand *pCommand : m_Commands) {
+        auto it = m_Devices.find(pCommand->pDevice);
+        switch(pCommand->nType) {
+            case CMD_ADD:
+                if(it == m_Devices.end()) {
+                    PolledDevice Device;
+                    Device.nGeneration = m_nNextGeneration++;
+                    Device.pInFlight = nullptr;
+                    Device.pHedge = nullptr;
+                    Device.bHedgeArmed = false;
+                    m_Devices[pCommand->pDevice] = Device;
+                    // Connect already fetched the first sample
+                    schedule(pCommand->pDevice, Device.nGeneration, pCommand->pDevice->getPollIntervalMs());
+                }
+                break;
+
+            case CMD_REMOVE:
+                if(it != m_Devices.end()) {
+                    // this aborts the transfer if there is one in progress
+                    if(it->second.pInFlight)
+                        curl_multi_remove_handle(m_Multi, it->second.pInFlight);
+                    if(it->second.pHedge)
+                        curl_multi_remove_handle(m_Multi, it->second.pHedge);
+                    // wheel entries are dropped lazily, their generation won't match anymore
+                    m_Devices.erase(it);
+                }
+                break;
+        }
+        pCommand->bDone = true;
+    }
+    m_Commands.clear();
+    m_CommandDone.notify_all();
+}
+
+void CEaglePoller::schedule(CWeatherEagle *pDevice, uint64_t nGeneration, int nDelayMs)
+{
+    WheelEntry Entry;
+    size_t nTicks;
+
+    nTicks = std::max(1, (nDelayMs + POLLER_TICK_MS - 1) / POLLER_TICK_MS);
+    Entry.pDevice = pDevice;
+    Entry.nGeneration = nGeneration;
+    Entry.nRounds = int((nTicks - 1) / POLLER_WHEEL_SLOTS);
+    m_Wheel[(m_nWheelPos + nTicks) % POLLER_WHEEL_SLOTS].push_back(Entry);
+}
+
+void CEaglePoller::advanceWheel(std::vector<WheelEntry> &vDue)
+{
+    std::vector<WheelEntry> &vSlot = m_Wheel[m_nWheelPos];
+    size_t nKept = 0;
+
+    for(size_t i = 0; i < vSlot.size(); i++) {
+        if(vSlot[i].nRounds > 0) {
+            vSlot[i].nRounds--;
+            vSlot[nKept++] = vSlot[i];
+        }
+        else {
+            vDue.push_back(vSlot[i]);
+        }
+    }
+    vSlot.resize(nKept);
+}
+
+// returns false if no request was started and the device needs to be rescheduled
+bool CEaglePoller::startPoll(CWeatherEagle *pDevice)
+{
+    PolledDevice &Device = m_Devices[pDevice];
+    CURL *pEasy;
+    int nHedgeDelayMs;
+
+    pEasy = pDevice->beginPoll();
+    if(!pEasy) // breaker open or device not ready
+        return false;
+
+    curl_easy_setopt(pEasy, CURLOPT_PRIVATE, pDevice);
+    if(curl_multi_add_handle(m_Multi, pEasy) != CURLM_OK) {
+        pDevice->endPoll(CURLE_FAILED_INIT, pEasy);
+        return false;
+    }
+    Device.pInFlight = pEasy;
+
+    // every poll earns a fraction of a hedge, up to a small burst
+    m_nHedgeBudget = std::min(m_nHedgeBudget + HEDGE_BUDGET_PERCENT, HEDGE_BUDGET_BURST * 100);
+    nHedgeDelayMs = pDevice->getHedgeDelayMs();
+    Device.bHedgeArmed = nHedgeDelayMs >= 0;
+    if(Device.bHedgeArmed)
+        Device.tHedgeAt = std::chrono::steady_clock::now() + std::chrono::milliseconds(nHedgeDelayMs);
+    return true;
+}
+
+// Send the second request of the polls that ran past their device latency percentile.
+// nTimeoutMs is lowered to wake up in time for the next one.
+void CEaglePoller::startHedges(int &nTimeoutMs)
+{
+    std::chrono::steady_clock::time_point tNow = std::chrono::steady_clock::now();
+    CURL *pEasy;
+    int nWaitMs;
+
+    for(auto &Device : m_Devices) {
+        PolledDevice &Polled = Device.second;
+        if(!Polled.bHedgeArmed || !Polled.pInFlight)
+            continue;
+        if(tNow < Polled.tHedgeAt) {
+            nWaitMs = int(std::chrono::duration_cast<std::chrono::milliseconds>(Polled.tHedgeAt - tNow).count()) + 1;
+            nTimeoutMs = std::min(nTimeoutMs, nWaitMs);
+            continue;
+        }
+        Polled.bHedgeArmed = false;
+        // the budget keeps a slow device from getting twice the load
+        if(m_nHedgeBudget < 100) {
+            Device.first->hedgeDenied();
+            continue;
+        }
+        pEasy = Device.first->beginHedge();
+        if(!pEasy)
+            continue;
+        curl_easy_setopt(pEasy, CURLOPT_PRIVATE, Device.first);
+        if(curl_multi_add_handle(m_Multi, pEasy) != CURLM_OK)
+            continue;
+        m_nHedgeBudget -= 100;
+        Polled.pHedge = pEasy;
+    }
+}
+
+void CEaglePoller::readCompletedTransfers()
+{
+    CURLMsg *pMsg;
+    int nMsgLeft;
+    CWeatherEagle *pDevice;
+    CURL *pEasy;
+    CURLcode res;
+
+    while((pMsg = curl_multi_info_read(m_Multi, &nMsgLeft))) {
+        if(pMsg->msg != CURLMSG_DONE)
+            continue;
+        // the message goes away with its handle, keep what we need
+        pEasy = pMsg->easy_handle;
+        res = pMsg->data.result;
+
+        pDevice = nullptr;
+        curl_easy_getinfo(pEasy, CURLINFO_PRIVATE, (char **)&pDevice);
+        curl_multi_remove_handle(m_Multi, pEasy);
+
+        auto it = m_Devices.find(pDevice);
+        if(it == m_Devices.end())
+            continue;
+
+        PolledDevice &Polled = it->second;
+        if(pEasy == Polled.pInFlight)
+            Polled.pInFlight = nullptr;
+        else if(pEasy == Polled.pHedge)
+            Polled.pHedge = nullptr;
+        else
+            continue;
+        // a failed request still has a chance if the other one is running
+        if(res != CURLE_OK && (Polled.pInFlight || Polled.pHedge))
+            continue;
+        Polled.bHedgeArmed = false;
+        // first answer wins, drop the other request
+        if(Polled.pInFlight) {
+            curl_multi_remove_handle(m_Multi, Polled.pInFlight);
+            Polled.pInFlight = nullptr;
+        }
+        if(Polled.pHedge) {
+            curl_multi_remove_handle(m_Multi, Polled.pHedge);
+            Polled.pHedge = nullptr;
+        }
+        pDevice->endPoll(res, pEasy);
+        // the device may move the next poll to just after its own sensor refresh
+        schedule(pDevice, Polled.nGeneration, pDevice->nextPollDelayMs());
+    }
+}
+
+void CEaglePoller::run()
+{
+    std::vector<WheelEntry> vDue;
+    int nRunning;
+    int nTimeoutMs;
+    std::chrono::steady_clock::time_point tNow;
+
+    while(m_bRunning) {
+        processCommands();
+
+        // fire the timers that expired since the last pass
+        tNow = std::chrono::steady_clock::now();
+        while(tNow >= m_tNextTick) {
+            m_nWheelPos = (m_nWheelPos + 1) % POLLER_WHEEL_SLOTS;
+            m_tNextTick += std::chrono::milliseconds(POLLER_TICK_MS);
+            advanceWheel(vDue);
+        }
+        for(WheelEntry &Entry : vDue) {
+            auto it = m_Devices.find(Entry.pDevice);
+            if(it == m_Devices.end() || it->second.nGeneration != Entry.nGeneration)
+                continue; // device was removed or refreshed since this was scheduled
+            if(it->second.pInFlight || it->second.pHedge)
+                continue; // previous request still running, it reschedules on completion
+            if(!startPoll(Entry.pDevice)) // try again at the next cadence
+                schedule(Entry.pDevice, it->second.nGeneration, Entry.pDevice->getPollIntervalMs());
+        }
+        vDue.clear();
+
+        curl_multi_perform(m_Multi, &nRunning);
+        readCompletedTransfers();
+
+        tNow = std::chrono::steady_clock::now();
+        nTimeoutMs = int(std::chrono::duration_cast<std::chrono::milliseconds>(m_tNextTick - tNow).count());
+        if(nTimeoutMs < 0)
+            nTimeoutMs = 0;
+        startHedges(nTimeoutMs);
+        curl_multi_poll(m_Multi, NULL, 0, nTimeoutMs, NULL);
+    }
+
+    // drop whatever is still in flight, the devices clean up their own handles
+    for(auto &Device : m_Devices) {
+        if(Device.second.pInFlight)
+            curl_multi_remove_handle(m_Multi, Device.second.pInFlight);
+        if(Device.second.pHedge)
+            curl_multi_remove_handle(m_Multi, Device.second.pHedge);
+    }
+    m_Devices.clear();
+    m_vRefresh.clear();
+    for(auto &vSlot : m_Wheel)
+        vSlot.clear();
+    processCommands();
+}
@@ -0,0 +1,102 @@
+//
+//  EaglePoller.h
+//  CEaglePoller
+//
+//  WeatherEagle X2 plugin
+//
+//  Single thread poller shared by all the Eagle devices of the process.
+//  All the /getecco requests are multiplexed on one curl multi handle and
+//  each device cadence is kept in a hashed timer wheel.
+
+#ifndef __EaglePoller__
+#define __EaglePoller__
+
+#ifndef SB_WIN_BUILD
+#include <curl/curl.h>
+#else
+#include "win_includes/curl.h"
+#endif
+
+#include <stdint.h>
+#include <vector>
+#include <map>
+#include <deque>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+#define POLLER_TICK_MS      100     // timer wheel resolution
+#define POLLER_WHEEL_SLOTS  512     // one turn of the wheel is 51.2 seconds
+
+class CWeatherEagle;
+
+class CEaglePoller
+{
+public:
+    static CEaglePoller& instance();
+
+    // the cadence is asked to the device after each poll, so it can change while polled
+    void    addDevice(CWeatherEagle *pDevice);
+    void    removeDevice(CWeatherEagle *pDevice);
+    bool    refreshDevice(CWeatherEagle *pDevice);
+    int     getDeviceCount();
+
+private:
+    CEaglePoller();
+    ~CEaglePoller();
+    CEaglePoller(const CEaglePoller&) = delete;
+    CEaglePoller& operator=(const CEaglePoller&) = delete;
+
+    enum PollerCommandType {CMD_ADD=0, CMD_REMOVE};
+
+    typedef struct {
+        int             nType;
+        CWeatherEagle   *pDevice;
+        bool            bDone;
+    } PollerCommand;
+
+    typedef struct {
+        uint64_t        nGeneration;
+        CURL            *pInFlight;
+        CURL            *pHedge;        // second request for the same poll, first answer wins
+        bool            bHedgeArmed;
+        std::chrono::steady_clock::time_point tHedgeAt;
+    } PolledDevice;
+
+    typedef struct {
+        CWeatherEagle   *pDevice;
+        uint64_t        nGeneration;
+        int             nRounds;
+    } WheelEntry;
+
+    void    run();
+    void    sendCommand(PollerCommand &Command);
+    void    processCommands();
+    void    schedule(CWeatherEagle *pDevice, uint64_t nGeneration, int nDelayMs);
+    void    advanceWheel(std::vector<WheelEntry> &vDue);
+    bool    startPoll(CWeatherEagle *pDevice);
+    void    startHedges(int &nTimeoutMs);
+    void    readCompletedTransfers();
+
+    // owned by the caller threads, protected by m_CommandMutex
+    std::mutex                  m_CommandMutex;
+    std::condition_variable     m_CommandDone;
+    std::deque<PollerCommand*>  m_Commands;
+    std::vector<CWeatherEagle*> m_vRefresh;
+    int                         m_nDeviceCount;
+    std::thread                 m_th;
+    std::atomic<bool>           m_bRunning;
+
+    // owned by the poller thread
+    CURLM                                   *m_Multi;
+    std::map<CWeatherEagle*, PolledDevice>  m_Devices;
+    std::vector<std::vector<WheelEntry>>    m_Wheel;
+    size_t                                  m_nWheelPos;
+    uint64_t                                m_nNextGeneration;
+    int                                     m_nHedgeBudget;     // hundredths of a hedge, shared by all devices
+    std::chrono::steady_clock::time_point   m_tNextTick;
+};
+
+#endif
@@ -0,0 +1,246 @@
+//
+//  EagleProbe.cpp
+//  CEagleProbe
+//
+//  WeatherEagle X2 plugin
+
+#include "EagleProbe.h"
+
+CEagleProbe::CEagleProbe()
+{
+    m_nState = PROBE_IDLE;
+    m_bCancel = false;
+    m_bCurlRuntime = false;
+    m_Multi = nullptr;
+    m_Curl = nullptr;
+}
+
+CEagleProbe::~CEagleProbe()
+{
+    cancel();
+}
+
+bool CEagleProbe::start(const WeatherEagleConfig &Config)
+{
+    if(m_nState == PROBE_RUNNING)
+        return false;
+    // previous test is done, collect its thread
+    if(m_th.joinable())
+        m_th.join();
+    cleanup();
+
+    if(!CCurlRuntime::acquire())
+        return false;
+    m_bCurlRuntime = true;
+    m_Multi = curl_multi_init();
+    m_Curl = curl_easy_init();
+    if(!m_Multi || !m_Curl) {
+        cleanup();
+        return false;
+    }
+
+    m_Config = Config;
+    m_Config.sBaseUrl = CWeatherEagle::makeBaseUrl(Config.sIpAddress, Config.nTcpPort, Config.Tls.bHttps);
+    {
+        const std::lock_guard<std::mutex> lock(m_ResultMutex);
+        m_Result.nErr = PLUGIN_OK;
+        m_Result.sError.clear();
+        m_Result.nConnectMs = -1;
+        m_Result.nInfoMs = -1;
+        m_Result.sModel.clear();
+        m_Result.sFirmware.clear();
+        m_Result.nSamples = 0;
+        m_Result.nValidSamples = 0;
+        m_Result.nMinMs = m_Result.nMedianMs = m_Result.nMaxMs = -1;
+    }
+    m_bCancel = false;
+    m_nState = PROBE_RUNNING;
+    m_th = std::thread(&CEagleProbe::run, this);
+    return true;
+}
+
+void CEagleProbe::cancel()
+{
+    m_bCancel = true;
+    if(m_Multi)
+        curl_multi_wakeup(m_Multi);
+    if(m_th.joinable())
+        m_th.join();
+    cleanup();
+    m_nState = PROBE_IDLE;
+}
+
+void CEagleProbe::getResult(EagleProbeResult &Result)
+{
+    const std::lock_guard<std::mutex> lock(m_ResultMutex);
+    Result = m_Result;
+}
+
+void CEagleProbe::cleanup()
+{
+    if(m_Curl)
+        curl_easy_cleanup(m_Curl);
+    if(m_Multi)
+        curl_multi_cleanup(m_Multi);
+    m_Curl = nullptr;
+    m_Multi = nullptr;
+    if(m_bCurlRuntime) {
+        CCurlRuntime::release();
+        m_bCurlRuntime = false;
+    }
+}
+
+#pragma mark - test thread
+
+void CEagleProbe::run()
+{
+    EagleProbeResult Result;
+    std::string sResponse;
+    std::vector<int> vTimes;
+    CURLcode res;
+    curl_off_t nConnectUs = 0;
+    json jResp;
+    int nMs;
+
+    Result.nErr = PLUGIN_OK;
+    Result.nConnectMs = -1;
+    Result.nInfoMs = -1;
+    Result.nSamples = 0;
+    Result.nValidSamples = 0;
+    Result.nMinMs = Result.nMedianMs = Result.nMaxMs = -1;
+
+    // first request pays for the connection, the next ones reuse it like the poller does
+    res = timedGet("/getinfo", sResponse, nMs);
+    if(res == CURLE_OK) {
+        curl_easy_getinfo(m_Curl, CURLINFO_CONNECT_TIME_T, &nConnectUs);
+        Result.nConnectMs = int(nConnectUs / 1000);
+        Result.nInfoMs = nMs;
+        try {
+            jResp = json::parse(sResponse);
+            if(jResp.contains("model") && jResp["model"].is_string())
+                Result.sModel = jResp["model"].get<std::string>();
+            if(jResp.contains("firmwareversion") && jResp["firmwareversion"].is_string())
+                Result.sFirmware = jResp["firmwareversion"].get<std::string>();
+        }
+        catch (json::exception& e) {
+            Result.sError = "invalid /getinfo response";
+        }
+    }
+    else if(res != CURLE_ABORTED_BY_CALLBACK) {
+        Result.sError = std::string("/getinfo : ") + curl_easy_strerror(res);
+    }
+
+    for(int i = 0; i < PROBE_ECCO_SAMPLES && !m_bCancel; i++) {
+        if(i && !waitOrCancel(PROBE_SAMPLE_GAP_MS))
+            break;
+        res = timedGet("/getecco", sResponse, nMs);
+        if(res != CURLE_OK) {
+            if(res != CURLE_ABORTED_BY_CALLBACK && Result.sError.empty())
+                Result.sError = std::string("/getecco : ") + curl_easy_strerror(res);
+            continue;
+        }
+        if(Result.nConnectMs < 0) {
+            curl_easy_getinfo(m_Curl, CURLINFO_CONNECT_TIME_T, &nConnectUs);
+            Result.nConnectMs = int(nConnectUs / 1000);
+        }
+        vTimes.push_back(nMs);
+        try {
+            jResp = json::parse(sResponse);
+            if(jResp.at("result").get<std::string>() == "OK" && jResp.at("ecco").get<std::string>() == "Connected")
+                Result.nValidSamples++;
+        }
+        catch (json::exception& e) {
+        }
+    }
+
+    Result.nSamples = int(vTimes.size());
+    if(!vTimes.empty()) {
+        std::sort(vTimes.begin(), vTimes.end());
+        Result.nMinMs = vTimes.front();
+        Result.nMedianMs = vTimes[vTimes.size() / 2];
+        Result.nMaxMs = vTimes.back();
+    }
+    if(Result.nInfoMs < 0 && !Result.nSamples)
+        Result.nErr = ERR_COMMNOLINK;
+
+    {
+        const std::lock_guard<std::mutex> lock(m_ResultMutex);
+        m_Result = Result;
+    }
+    m_nState = PROBE_DONE;
+}
+
+// Blocking GET on the probe multi handle, cancel() wakes it up. nMs is the total transfer time.
+CURLcode CEagleProbe::timedGet(const std::string &sPath, std::string &sResponse, int &nMs)
+{
+    CURLcode res = CURLE_OK;
+    CURLMsg *pMsg;
+    curl_off_t nTotalUs = 0;
+    int nRunning = 1;
+    int nMsgLeft;
+    long nTimeoutMs = m_Config.nTransferTimeoutMs > 0 ? m_Config.nTransferTimeoutMs : PROBE_DEFAULT_TIMEOUT_MS;
+
+    sResponse.clear();
+    nMs = -1;
+    curl_easy_setopt(m_Curl, CURLOPT_URL, (m_Config.sBaseUrl + sPath).c_str());
+    curl_easy_setopt(m_Curl, CURLOPT_HTTPGET, 1L);
+    curl_easy_setopt(m_Curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(m_Curl, CURLOPT_WRITEFUNCTION, CWeatherEagle::writeFunction);
+    curl_easy_setopt(m_Curl, CURLOPT_WRITEDATA, &sResponse);
+    curl_easy_setopt(m_Curl, CURLOPT_FAILONERROR, 1L);
+    curl_easy_setopt(m_Curl, CURLOPT_CONNECTTIMEOUT_MS, long(m_Config.nConnectTimeoutMs));
+    curl_easy_setopt(m_Curl, CURLOPT_TIMEOUT_MS, nTimeoutMs);
+    curl_easy_setopt(m_Curl, CURLOPT_SSL_VERIFYPEER, m_Config.Tls.bVerifyPeer ? 1L : 0L);
+    curl_easy_setopt(m_Curl, CURLOPT_SSL_VERIFYHOST, m_Config.Tls.bVerifyPeer ? 2L : 0L);
+    if(!m_Config.Tls.sPinnedPublicKey.empty())
+        curl_easy_setopt(m_Curl, CURLOPT_PINNEDPUBLICKEY, m_Config.Tls.sPinnedPublicKey.c_str());
+
+    if(m_bCancel)
+        return CURLE_ABORTED_BY_CALLBACK;
+    if(curl_multi_add_handle(m_Multi, m_Curl) != CURLM_OK)
+        return CURLE_FAILED_INIT;
+
+    while(true) {
+        if(curl_multi_perform(m_Multi, &nRunning) != CURLM_OK) {
+            res = CURLE_FAILED_INIT;
+            break;
+        }
+        if(!nRunning)
+            break;
+        if(m_bCancel) {
+            res = CURLE_ABORTED_BY_CALLBACK;
+            break;
+        }
+        curl_multi_poll(m_Multi, NULL, 0, 1000, NULL);
+    }
+
+    if(!nRunning) {
+        while((pMsg = curl_multi_info_read(m_Multi, &nMsgLeft))) {
+            if(pMsg->msg == CURLMSG_DONE && pMsg->easy_handle == m_Curl)
+                res = pMsg->data.result;
+        }
+    }
+    curl_multi_remove_handle(m_Multi, m_Curl);
+
+    if(res == CURLE_OK) {
+        curl_easy_getinfo(m_Curl, CURLINFO_TOTAL_TIME_T, &nTotalUs);
+        nMs = int(nTotalUs / 1000);
+    }
+    return res;
+}
+
+// sleep that cancel() cuts short, false if cancelled
+bool CEagleProbe::waitOrCancel(int nMs)
+{
+    std::chrono::steady_clock::time_point tEnd = std::chrono::steady_clock::now() + std::chrono::milliseconds(nMs);
+    int nLeftMs;
+
+    while(!m_bCancel) {
+        nLeftMs = int(std::chrono::duration_cast<std::chrono::milliseconds>(tEnd - std::chrono::steady_clock::now()).count());
+        if(nLeftMs <= 0)
+            return true;
+        // nothing attached, this only returns on timeout or wakeup
+        curl_multi_poll(m_Multi, NULL, 0, nLeftMs, NULL);
+    }
+    return false;
+}
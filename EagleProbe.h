@@ -0,0 +1,77 @@
+//
+//  EagleProbe.h
+//  CEagleProbe
+//
+//  WeatherEagle X2 plugin
+//
+//  Connectivity and latency test run from the settings dialog.
+//  /getinfo then a few timed /getecco requests against a candidate configuration,
+//  on its own thread and its own curl handles, so the UI and the live device are
+//  never held up. Cancelling wakes the transfer up, the dialog can close right away.
+
+#ifndef __EagleProbe__
+#define __EagleProbe__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <atomic>
+
+#include "WeatherEagle.h"
+
+#define PROBE_ECCO_SAMPLES          5
+#define PROBE_SAMPLE_GAP_MS         250     // don't hammer the device between samples
+#define PROBE_DEFAULT_TIMEOUT_MS    5000    // per request, when the config has no transfer deadline
+
+enum ProbeStates {PROBE_IDLE=0, PROBE_RUNNING, PROBE_DONE};
+
+typedef struct {
+    int         nErr;           // PLUGIN_OK if the device answered at all
+    std::string sError;         // first error seen, empty if none
+    int         nConnectMs;     // TCP (and TLS) connect of the first request, -1 if none
+    int         nInfoMs;        // /getinfo round trip, -1 if it failed
+    std::string sModel;
+    std::string sFirmware;
+    int         nSamples;       // /getecco requests that completed
+    int         nValidSamples;  // of those, OK with the ECCO connected
+    int         nMinMs;
+    int         nMedianMs;
+    int         nMaxMs;
+} EagleProbeResult;
+
+class CEagleProbe
+{
+public:
+    CEagleProbe();
+    ~CEagleProbe();
+
+    // false if a test is already running or curl could not be set up
+    bool    start(const WeatherEagleConfig &Config);
+    // stops a running test and waits for its thread
+    void    cancel();
+    int     getState() { return m_nState; }
+    // valid once the state is PROBE_DONE
+    void    getResult(EagleProbeResult &Result);
+
+private:
+    void        run();
+    CURLcode    timedGet(const std::string &sPath, std::string &sResponse, int &nMs);
+    bool        waitOrCancel(int nMs);
+    void        cleanup();
+
+    WeatherEagleConfig      m_Config;
+    std::thread             m_th;
+    std::atomic<int>        m_nState;
+    std::atomic<bool>       m_bCancel;
+    bool                    m_bCurlRuntime;
+    CURLM                   *m_Multi;
+    CURL                    *m_Curl;
+
+    std::mutex              m_ResultMutex;
+    EagleProbeResult        m_Result;
+};
+
+#endif
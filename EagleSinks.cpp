@@ -0,0 +1,348 @@
+//
+//  EagleSinks.cpp
+//  CSnapshotSink
+//
+//  WeatherEagle X2 plugin
+
+#include "EagleSinks.h"
+
+#ifdef SB_WIN_BUILD
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include <time.h>
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free && std::atomic<uint64_t>::is_always_lock_free,
+              "shared memory sequence lock needs lock free atomics");
+
+#pragma mark - shared memory
+
+CSharedMemorySink::CSharedMemorySink()
+{
+    m_pSegment = nullptr;
+#ifdef SB_WIN_BUILD
+    m_hMapping = NULL;
+#endif
+}
+
+CSharedMemorySink::~CSharedMemorySink()
+{
+    stop();
+}
+
+bool CSharedMemorySink::start(CWeatherEagle *pDevice)
+{
+    void *pMem;
+
+    if(m_pSegment)
+        return true;
+
+    m_sName = EAGLE_SHM_PREFIX + pDevice->getDeviceTag();
+
+#ifdef SB_WIN_BUILD
+    m_hMapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, sizeof(EagleShmSegment), m_sName.c_str());
+    if(!m_hMapping)
+        return false;
+    pMem = MapViewOfFile(m_hMapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(EagleShmSegment));
+    if(!pMem) {
+        CloseHandle(m_hMapping);
+        m_hMapping = NULL;
+        return false;
+    }
+#else
+    int fd = shm_open(m_sName.c_str(), O_CREAT | O_RDWR, 0644);
+    if(fd < 0)
+        return false;
+    if(ftruncate(fd, sizeof(EagleShmSegment)) != 0) {
+        close(fd);
+        return false;
+    }
+    pMem = mmap(NULL, sizeof(EagleShmSegment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(pMem == MAP_FAILED)
+        return false;
+#endif
+
+    // the segment may be left over from a previous session, readers wait for the magic
+    m_pSegment = (EagleShmSegment *)pMem;
+    m_pSegment->nMagic = 0;
+    std::atomic_thread_fence(std::memory_order_release);
+    m_pSegment->nVersion = EAGLE_SHM_VERSION;
+    m_pSegment->nHeaderSize = uint16_t(offsetof(EagleShmSegment, Words));
+    m_pSegment->nRecordSize = uint32_t(sizeof(EagleShmRecord));
+    std::atomic_thread_fence(std::memory_order_release);
+    m_pSegment->nMagic = EAGLE_SHM_MAGIC;
+    return true;
+}
+
+void CSharedMemorySink::stop()
+{
+    if(!m_pSegment)
+        return;
+
+    // tell attached readers the data is no longer maintained
+    m_pSegment->nMagic = 0;
+#ifdef SB_WIN_BUILD
+    UnmapViewOfFile(m_pSegment);
+    CloseHandle(m_hMapping);
+    m_hMapping = NULL;
+#else
+    munmap(m_pSegment, sizeof(EagleShmSegment));
+    shm_unlink(m_sName.c_str());
+#endif
+    m_pSegment = nullptr;
+}
+
+void CSharedMemorySink::publish(const WeatherEagleSnapshot &Snapshot)
+{
+    EagleShmRecord Record;
+    uint64_t Words[EAGLE_SHM_WORDS] = {};
+    uint32_t nSeq;
+
+    if(!m_pSegment)
+        return;
+
+    memset(&Record, 0, sizeof(Record));
+    Record.nSeq = Snapshot.nSeq;
+    Record.nWallTimeMs = Snapshot.nWallTimeMs;
+    Record.nTimestampMs = Snapshot.nTimestampMs;
+    Record.nFlags = Snapshot.nFlags;
+    Record.nChangedFields = Snapshot.nChangedFields;
+    Record.dTemp = Snapshot.dTemp;
+    Record.dHumidity = Snapshot.dPercentHumdity;
+    Record.dDewPoint = Snapshot.dDewPointTemp;
+    Record.dPressure = Snapshot.dBarometricPressure;
+    memcpy(Record.dExtTemp, Snapshot.dExtTemp, sizeof(Record.dExtTemp));
+    memcpy(Record.szFirmware, Snapshot.szFirmware, sizeof(Record.szFirmware));
+    memcpy(Record.szModel, Snapshot.szModel, sizeof(Record.szModel));
+    memcpy(Words, &Record, sizeof(Record));
+
+    // single writer, publishSnapshot serializes the calls
+    nSeq = m_pSegment->nSeq.load(std::memory_order_relaxed);
+    m_pSegment->nSeq.store(nSeq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for(size_t i = 0; i < EAGLE_SHM_WORDS; i++)
+        m_pSegment->Words[i].store(Words[i], std::memory_order_relaxed);
+    m_pSegment->nSeq.store(nSeq + 2, std::memory_order_release);
+}
+
+bool CSharedMemorySink::read(const std::string &sName, EagleShmRecord &Record)
+{
+    const EagleShmSegment *pSegment;
+    uint64_t Words[EAGLE_SHM_WORDS];
+    uint32_t nSeqBefore, nSeqAfter;
+    bool bOk = false;
+
+#ifdef SB_WIN_BUILD
+    HANDLE hMapping = OpenFileMappingA(FILE_MAP_READ, FALSE, sName.c_str());
+    if(!hMapping)
+        return false;
+    pSegment = (const EagleShmSegment *)MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, sizeof(EagleShmSegment));
+    if(!pSegment) {
+        CloseHandle(hMapping);
+        return false;
+    }
+#else
+    int fd = shm_open(sName.c_str(), O_RDONLY, 0);
+    if(fd < 0)
+        return false;
+    void *pMem = mmap(NULL, sizeof(EagleShmSegment), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(pMem == MAP_FAILED)
+        return false;
+    pSegment = (const EagleShmSegment *)pMem;
+#endif
+
+    if(pSegment->nMagic == EAGLE_SHM_MAGIC && pSegment->nVersion == EAGLE_SHM_VERSION) {
+        do {
+            nSeqBefore = pSegment->nSeq.load(std::memory_order_acquire);
+            for(size_t i = 0; i < EAGLE_SHM_WORDS; i++)
+                Words[i] = pSegment->Words[i].load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            nSeqAfter = pSegment->nSeq.load(std::memory_order_relaxed);
+        } while((nSeqBefore & 1) || nSeqBefore != nSeqAfter);
+        memcpy(&Record, Words, sizeof(Record));
+        bOk = Record.nSeq != 0;
+    }
+
+#ifdef SB_WIN_BUILD
+    UnmapViewOfFile(pSegment);
+    CloseHandle(hMapping);
+#else
+    munmap(pMem, sizeof(EagleShmSegment));
+#endif
+    return bOk;
+}
+
+#pragma mark - Boltwood one-line file
+
+// Date       Time        T V   SkyT   AmbT   SenT   Wind Hum  DewPt  Hea R W Since  Now()        c w r d C A
+static const char *BoltwoodLineFormat = "%04d-%02d-%02d %02d:%02d:%05.2f C K %6.1f %6.1f %6.1f %6.1f %3d %6.1f %03d %1d %1d %05d %012.5f %1d %1d %1d %1d %1d %1d\n";
+
+#define BOLTWOOD_NO_SKY_TEMP    -999.0  // the Eagle has no sky sensor
+
+CBoltwoodFileSink::CBoltwoodFileSink(const std::string &sPath, int nIntervalMs)
+{
+    m_sPath = sPath;
+    m_sTmpPath = sPath + ".tmp";
+    m_nIntervalMs = std::max(nIntervalMs, BOLTWOOD_MIN_INTERVAL_MS);
+    m_bRunning = false;
+    m_bNewData = false;
+    memset(&m_Snapshot, 0, sizeof(m_Snapshot));
+}
+
+CBoltwoodFileSink::~CBoltwoodFileSink()
+{
+    stop();
+}
+
+bool CBoltwoodFileSink::start(CWeatherEagle *)
+{
+    if(m_bRunning)
+        return true;
+    if(m_sPath.empty())
+        return false;
+    m_bRunning = true;
+    m_th = std::thread(&CBoltwoodFileSink::run, this);
+    return true;
+}
+
+void CBoltwoodFileSink::stop()
+{
+    {
+        const std::lock_guard<std::mutex> lock(m_Mutex);
+        if(!m_bRunning)
+            return;
+        m_bRunning = false;
+    }
+    m_Cv.notify_all();
+    if(m_th.joinable())
+        m_th.join();
+}
+
+void CBoltwoodFileSink::publish(const WeatherEagleSnapshot &Snapshot)
+{
+    {
+        const std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Snapshot = Snapshot;
+        m_bNewData = true;
+    }
+    m_Cv.notify_one();
+}
+
+void CBoltwoodFileSink::run()
+{
+    std::unique_lock<std::mutex> lock(m_Mutex);
+    std::chrono::steady_clock::time_point tLastWrite = std::chrono::steady_clock::now() - std::chrono::milliseconds(m_nIntervalMs);
+    std::chrono::steady_clock::time_point tNext;
+    WeatherEagleSnapshot Snapshot;
+
+    while(m_bRunning) {
+        // new data is written once the interval has elapsed, old data every BOLTWOOD_REFRESH_MS
+        tNext = tLastWrite + std::chrono::milliseconds(m_bNewData ? m_nIntervalMs : BOLTWOOD_REFRESH_MS);
+        if(std::chrono::steady_clock::now() < tNext) {
+            if(m_bNewData)
+                m_Cv.wait_until(lock, tNext, [this]{ return !m_bRunning; });
+            else
+                m_Cv.wait_until(lock, tNext, [this]{ return !m_bRunning || m_bNewData; });
+            continue;
+        }
+        Snapshot = m_Snapshot;
+        m_bNewData = false;
+        tLastWrite = std::chrono::steady_clock::now();
+        if(!Snapshot.nSeq)
+            continue;   // nothing to report yet
+
+        // file I/O without the lock, publish never waits on the disk
+        lock.unlock();
+        writeFile(Snapshot);
+        lock.lock();
+    }
+}
+
+bool CBoltwoodFileSink::writeFile(const WeatherEagleSnapshot &Snapshot)
+{
+    char szLine[BOLTWOOD_LINE_SIZE];
+    FILE *pFile;
+    int nLen;
+    bool bOk;
+
+    nLen = formatLine(Snapshot, szLine, sizeof(szLine));
+    if(nLen <= 0 || nLen >= int(sizeof(szLine)))
+        return false;
+
+    // readers only ever see a complete line
+    pFile = fopen(m_sTmpPath.c_str(), "w");
+    if(!pFile)
+        return false;
+    bOk = fwrite(szLine, 1, size_t(nLen), pFile) == size_t(nLen);
+    bOk = (fclose(pFile) == 0) && bOk;
+    if(!bOk) {
+        remove(m_sTmpPath.c_str());
+        return false;
+    }
+#ifdef SB_WIN_BUILD
+    return MoveFileExA(m_sTmpPath.c_str(), m_sPath.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    return rename(m_sTmpPath.c_str(), m_sPath.c_str()) == 0;
+#endif
+}
+
+int CBoltwoodFileSink::formatLine(const WeatherEagleSnapshot &Snapshot, char *pszLine, size_t nSize)
+{
+    struct tm Sample;
+    struct tm Now;
+    time_t tSample;
+    time_t tNow;
+    int64_t nAgeMs;
+    int nSince;
+    int nYear, nMonth, nDays;
+    double dVBNow;
+    bool bStale;
+
+    tSample = time_t(Snapshot.nWallTimeMs / 1000);
+    tNow = time(NULL);
+#ifdef SB_WIN_BUILD
+    localtime_s(&Sample, &tSample);
+    localtime_s(&Now, &tNow);
+#else
+    localtime_r(&tSample, &Sample);
+    localtime_r(&tNow, &Now);
+#endif
+
+    nAgeMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count() - Snapshot.nTimestampMs;
+    if(Snapshot.nFlags & SNAPSHOT_FLAG_WARM_START)
+        nAgeMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count() - Snapshot.nWallTimeMs;
+    nAgeMs = std::max<int64_t>(nAgeMs, 0);
+    nSince = int(std::min<int64_t>(nAgeMs / 1000, 99999));
+    // no fresh data, ask the consumers to close and raise the alert
+    bStale = nAgeMs > BOLTWOOD_STALE_MS;
+
+    // VB Now(), local days since 1899-12-30
+    nYear = Now.tm_year + 1900 - ((Now.tm_mon + 1) <= 2 ? 1 : 0);
+    nMonth = Now.tm_mon + 1;
+    nDays = 365 * nYear + nYear / 4 - nYear / 100 + nYear / 400 + (153 * (nMonth + (nMonth > 2 ? -3 : 9)) + 2) / 5 + Now.tm_mday - 1;
+    dVBNow = double(nDays - 693899) + (Now.tm_hour * 3600.0 + Now.tm_min * 60.0 + Now.tm_sec) / 86400.0;
+
+    return snprintf(pszLine, nSize, BoltwoodLineFormat,
+                    Sample.tm_year + 1900, Sample.tm_mon + 1, Sample.tm_mday,
+                    Sample.tm_hour, Sample.tm_min, Sample.tm_sec + int(Snapshot.nWallTimeMs % 1000) / 10 / 100.0,
+                    BOLTWOOD_NO_SKY_TEMP,
+                    Snapshot.dTemp,
+                    Snapshot.dTemp,
+                    0.0,                                // no wind sensor
+                    int(Snapshot.dPercentHumdity),
+                    Snapshot.dDewPointTemp,
+                    0,                                  // heater
+                    0, 0,                               // rain and wet flags
+                    nSince,
+                    dVBNow,
+                    0, 0, 0, 0,                         // cloud, wind, rain and daylight conditions unknown
+                    bStale ? 1 : 0,                     // roof close, the plugin never requests it on live data
+                    bStale ? 1 : 0);                    // alert
+}
@@ -0,0 +1,139 @@
+//
+//  EagleSinks.h
+//  CSnapshotSink
+//
+//  WeatherEagle X2 plugin
+//
+//  Sinks receive every snapshot published by a CWeatherEagle and export it
+//  to other consumers on the machine, so they never have to talk to the Eagle.
+
+#ifndef __EagleSinks__
+#define __EagleSinks__
+
+#include <stdint.h>
+#include <string>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "WeatherEagle.h"
+
+// shared memory segment, one per device, named EAGLE_SHM_PREFIX + CWeatherEagle::getDeviceTag()
+#ifdef SB_WIN_BUILD
+#define EAGLE_SHM_PREFIX    "Local\\X2_WeatherEagle_"
+#else
+#define EAGLE_SHM_PREFIX    "/X2_WeatherEagle_"
+#endif
+#define EAGLE_SHM_MAGIC     0x4D485345  // "ESHM"
+#define EAGLE_SHM_VERSION   1
+
+// Fixed binary layout of the exported readings, little endian, 8 byte aligned.
+// Only ever extended at the end, nRecordSize in the header tells readers how much is valid.
+typedef struct {
+    uint64_t    nSeq;               // device sample sequence
+    int64_t     nWallTimeMs;        // unix time of the sample
+    int64_t     nTimestampMs;       // CLOCK_MONOTONIC / QueryPerformanceCounter based time of the sample
+    uint32_t    nFlags;             // SNAPSHOT_FLAG_xxx
+    uint32_t    nChangedFields;     // (1 << FIELD_xxx) that moved past their deadband
+    double      dTemp;
+    double      dHumidity;
+    double      dDewPoint;
+    double      dPressure;
+    double      dExtTemp[3];
+    char        szFirmware[32];
+    char        szModel[32];
+} EagleShmRecord;
+
+// Boltwood / Clarity II one-line data file
+#define BOLTWOOD_MIN_INTERVAL_MS    1000    // never rewrite the file faster than this
+#define BOLTWOOD_REFRESH_MS         10000   // rewritten even without new data so "Since" keeps counting
+#define BOLTWOOD_STALE_MS           60000   // older data raises the close and alert flags
+#define BOLTWOOD_LINE_SIZE          160
+
+#define EAGLE_SHM_WORDS     ((sizeof(EagleShmRecord) + sizeof(uint64_t) - 1) / sizeof(uint64_t))
+
+// Segment header followed by the record, written with a sequence lock:
+// nSeq is odd while a write is in progress, readers copy the words and retry
+// if nSeq was odd or changed during the copy.
+typedef struct {
+    uint32_t                nMagic;         // EAGLE_SHM_MAGIC, set once the segment is initialized
+    uint16_t                nVersion;
+    uint16_t                nHeaderSize;    // offset of Words[]
+    uint32_t                nRecordSize;    // sizeof(EagleShmRecord)
+    std::atomic<uint32_t>   nSeq;
+    std::atomic<uint64_t>   Words[EAGLE_SHM_WORDS];
+} EagleShmSegment;
+
+class CSnapshotSink
+{
+public:
+    CSnapshotSink() { m_nWorker = 0; }
+    virtual ~CSnapshotSink() {}
+
+    // called by Connect/Disconnect, pDevice outlives the sink.
+    // The current snapshot, if any, is published right after start.
+    virtual bool start(CWeatherEagle *pDevice) = 0;
+    virtual void stop() = 0;
+    // called for every published snapshot, from one pipeline sink worker at a time, must not block
+    virtual void publish(const WeatherEagleSnapshot &Snapshot) = 0;
+
+    // pipeline sink worker serving this sink, set once when the device creates it
+    int     getWorker() { return m_nWorker; }
+    void    setWorker(int nWorker) { m_nWorker = nWorker; }
+
+private:
+    int     m_nWorker;
+};
+
+class CSharedMemorySink : public CSnapshotSink
+{
+public:
+    CSharedMemorySink();
+    ~CSharedMemorySink();
+
+    bool start(CWeatherEagle *pDevice);
+    void stop();
+    void publish(const WeatherEagleSnapshot &Snapshot);
+
+    // reader side, for local tools linking this file
+    static bool read(const std::string &sName, EagleShmRecord &Record);
+
+private:
+    std::string     m_sName;
+    EagleShmSegment *m_pSegment;
+#ifdef SB_WIN_BUILD
+    void            *m_hMapping;
+#endif
+};
+
+// Writes the Boltwood one-line format read by ACP, NINA, dome drivers...
+// from its own thread, at most once per interval, always with write + rename.
+class CBoltwoodFileSink : public CSnapshotSink
+{
+public:
+    CBoltwoodFileSink(const std::string &sPath, int nIntervalMs);
+    ~CBoltwoodFileSink();
+
+    bool start(CWeatherEagle *pDevice);
+    void stop();
+    void publish(const WeatherEagleSnapshot &Snapshot);
+
+private:
+    void    run();
+    bool    writeFile(const WeatherEagleSnapshot &Snapshot);
+    int     formatLine(const WeatherEagleSnapshot &Snapshot, char *pszLine, size_t nSize);
+
+    std::string             m_sPath;
+    std::string             m_sTmpPath;
+    int                     m_nIntervalMs;
+
+    std::thread             m_th;
+    std::mutex              m_Mutex;
+    std::condition_variable m_Cv;
+    bool                    m_bRunning;
+    bool                    m_bNewData;
+    WeatherEagleSnapshot    m_Snapshot;     // latest published, protected by m_Mutex
+};
+
+#endif
@@ -0,0 +1,110 @@
+//
+//  EagleSocket.cpp
+//
+//  WeatherEagle X2 plugin
+
+#include "EagleSocket.h"
+
+#ifndef SB_WIN_BUILD
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#endif
+
+#include <string.h>
+
+bool eagleSocketStartup()
+{
+#ifdef SB_WIN_BUILD
+    WSADATA wsaData;
+    return WSAStartup(MAKEWORD(2, 2), &wsaData) == 0;
+#else
+    return true;
+#endif
+}
+
+void eagleSocketCleanup()
+{
+#ifdef SB_WIN_BUILD
+    WSACleanup();
+#endif
+}
+
+void eagleCloseSocket(eagle_socket_t fd)
+{
+    if(fd == EAGLE_INVALID_SOCKET)
+        return;
+#ifdef SB_WIN_BUILD
+    closesocket(fd);
+#else
+    close(fd);
+#endif
+}
+
+bool eagleSetNonBlocking(eagle_socket_t fd)
+{
+#ifdef SB_WIN_BUILD
+    u_long nMode = 1;
+    return ioctlsocket(fd, FIONBIO, &nMode) == 0;
+#else
+    int nFlags = fcntl(fd, F_GETFL, 0);
+    return nFlags >= 0 && fcntl(fd, F_SETFL, nFlags | O_NONBLOCK) == 0;
+#endif
+}
+
+bool eagleWouldBlock()
+{
+#ifdef SB_WIN_BUILD
+    int nErr = WSAGetLastError();
+    return nErr == WSAEWOULDBLOCK || nErr == WSAEINPROGRESS;
+#else
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR || errno == EINPROGRESS;
+#endif
+}
+
+void eagleSetNoSigPipe(eagle_socket_t fd)
+{
+#ifdef SO_NOSIGPIPE
+    int nOn = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, (const char *)&nOn, sizeof(nOn));
+#else
+    (void)fd; // sends use MSG_NOSIGNAL there
+#endif
+}
+
+eagle_socket_t eagleOpenWakeSocket()
+{
+    struct sockaddr_in Addr;
+    socklen_t nAddrLen;
+    eagle_socket_t fd;
+
+    fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if(fd == EAGLE_INVALID_SOCKET)
+        return fd;
+    memset(&Addr, 0, sizeof(Addr));
+    Addr.sin_family = AF_INET;
+    Addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    nAddrLen = sizeof(Addr);
+    if(bind(fd, (struct sockaddr *)&Addr, sizeof(Addr)) != 0 ||
+       getsockname(fd, (struct sockaddr *)&Addr, &nAddrLen) != 0 ||
+       connect(fd, (struct sockaddr *)&Addr, sizeof(Addr)) != 0) {
+        eagleCloseSocket(fd);
+        return EAGLE_INVALID_SOCKET;
+    }
+    eagleSetNonBlocking(fd);
+    return fd;
+}
+
+void eagleWake(eagle_socket_t fd)
+{
+    char c = 0;
+    if(fd != EAGLE_INVALID_SOCKET)
+        send(fd, &c, 1, EAGLE_SEND_FLAGS);
+}
+
+void eagleDrainWake(eagle_socket_t fd)
+{
+    char szDrain[64];
+    while(recv(fd, szDrain, sizeof(szDrain), 0) > 0)
+        ;
+}
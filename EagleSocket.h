@@ -0,0 +1,50 @@
+//
+//  EagleSocket.h
+//
+//  WeatherEagle X2 plugin
+//
+//  Small portability layer for the network sinks (BSD sockets / Winsock).
+
+#ifndef __EagleSocket__
+#define __EagleSocket__
+
+#ifdef SB_WIN_BUILD
+#include <winsock2.h>
+#include <ws2tcpip.h>
+typedef SOCKET  eagle_socket_t;
+#define EAGLE_INVALID_SOCKET    INVALID_SOCKET
+#define eagle_poll              WSAPoll
+#define EAGLE_SEND_FLAGS        0
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <poll.h>
+typedef int     eagle_socket_t;
+#define EAGLE_INVALID_SOCKET    (-1)
+#define eagle_poll              poll
+#ifdef MSG_NOSIGNAL
+#define EAGLE_SEND_FLAGS        MSG_NOSIGNAL
+#else
+#define EAGLE_SEND_FLAGS        0   // macOS, SO_NOSIGPIPE is set on each socket
+#endif
+#endif
+
+#include <string>
+
+bool    eagleSocketStartup();       // WSAStartup on Windows, refcounted
+void    eagleSocketCleanup();
+void    eagleCloseSocket(eagle_socket_t fd);
+bool    eagleSetNonBlocking(eagle_socket_t fd);
+bool    eagleWouldBlock();          // last socket error was EAGAIN/EWOULDBLOCK/EINPROGRESS
+void    eagleSetNoSigPipe(eagle_socket_t fd);
+
+// Loopback udp socket connected to itself, lets other threads interrupt a poll()
+// without a pipe (works on Windows too).
+eagle_socket_t  eagleOpenWakeSocket();
+void            eagleWake(eagle_socket_t fd);
+void            eagleDrainWake(eagle_socket_t fd);
+
+#endif
@@ -6,27 +6,82 @@
 //  WeatherEagle X2 plugin
 
 #include "WeatherEagle.h"
-
-void threaded_poller(std::future<void> futureObj, CWeatherEagle *WeatherEagleControllerObj)
-{
-    while (futureObj.wait_for(std::chrono::milliseconds(5000)) == std::future_status::timeout) {
-        if(WeatherEagleControllerObj->m_DevAccessMutex.try_lock()) {
-            WeatherEagleControllerObj->getData();
-            WeatherEagleControllerObj->m_DevAccessMutex.unlock();
-        }
-        else {
-            std::this_thread::yield();
-        }
-    }
-}
+#include "EaglePoller.h"
+#include "EaglePipeline.h"
+#include "EagleSinks.h"
+#include "EagleHttpServer.h"
+#include "EagleMqtt.h"
+
+// /getecco fields, in WeatherEagleFields order.
+// A field has changed when it moved by more than both its absolute and its relative deadband.
+static const struct {
+    const char  *pszKey;
+    size_t      nOffset;
+    double      dAbsDeadband;   // in the field unit
+    double      dRelDeadband;   // fraction of the last reported value
+} EccoFields[FIELD_COUNT] = {
+    {"temp",        offsetof(WeatherEagleSnapshot, dTemp),                          0.05,   0.0},
+    {"hum",         offsetof(WeatherEagleSnapshot, dPercentHumdity),                0.2,    0.005},
+    {"dew",         offsetof(WeatherEagleSnapshot, dDewPointTemp),                  0.05,   0.0},
+    {"pressure",    offsetof(WeatherEagleSnapshot, dBarometricPressure),            0.0,    0.0001},
+    {"temp5",       offsetof(WeatherEagleSnapshot, dExtTemp) + 0 * sizeof(double),  0.05,   0.0},
+    {"temp6",       offsetof(WeatherEagleSnapshot, dExtTemp) + 1 * sizeof(double),  0.05,   0.0},
+    {"temp7",       offsetof(WeatherEagleSnapshot, dExtTemp) + 2 * sizeof(double),  0.05,   0.0},
+};
 
 CWeatherEagle::CWeatherEagle()
 {
+    std::chrono::steady_clock::time_point tStart = std::chrono::steady_clock::now();
+
     // set some sane values
     m_bIsConnected = false;
-    m_ThreadsAreRunning = false;
-    m_sIpAddress.clear();
-    m_nTcpPort = 0;
+    m_bPollerRunning = false;
+    m_nPipelineInFlight = 0;
+    WeatherEagleConfig Config;
+    initConfig(Config);
+    setConfig(Config);
+    m_nPollFields = 0;
+    m_Export.bSharedMemory = false;
+    m_Export.nHttpPort = 0;
+    m_Export.bAlpaca = false;
+    m_Export.nBoltwoodIntervalMs = BOLTWOOD_DEFAULT_INTERVAL_MS;
+    m_Export.nMqttPort = 0;
+    m_BreakerRng.seed(std::random_device{}());
+    breakerReset();
+    m_nSampleSeq = 0;
+    m_nLastGoodDataMs = -1;
+    m_bRefreshPending = false;
+    m_nLatencyMs = 0;
+    m_nNewConnections = 0;
+    m_nReusedConnections = 0;
+    m_nTlsHandshakes = 0;
+    m_nTlsHandshakeUs = 0;
+    m_nLastTlsHandshakeUs = 0;
+    m_bWarmStartValid = false;
+    m_nDeadbandRefValid = 0;
+    m_nLastChangeMs = 0;
+    m_nSamples = 0;
+    m_nUnchangedSamples = 0;
+    m_nDuplicateSamples = 0;
+    m_HedgeCurl = nullptr;
+    m_nPollLatencyCount = 0;
+    m_nPollLatencyPos = 0;
+    m_nHedgeDelayMs = -1;
+    m_nPolls = 0;
+    m_nHedges = 0;
+    m_nHedgeWins = 0;
+    m_nHedgeDenied = 0;
+    m_nRefreshCancelGen = 0;
+    m_nPollStartMs = 0;
+    m_nLastPublishedPollMs = 0;
+    phaseReset();
+    m_bAbort = false;
+    m_dFirmwareVersion = 0.0;
+    m_Caps.dFirmwareVersion = 0.0;
+    m_Caps.nEndpoints = 0;
+    m_Caps.nFields = 0;
+    m_Caps.nProbeTimeMs = 0;
+    setPollFields((1 << FIELD_COUNT) - 1);
 
 #ifdef PLUGIN_DEBUG
 #if defined(SB_WIN_BUILD)
@@ -52,9 +107,19 @@ CWeatherEagle::CWeatherEagle()
     m_sLogFile.flush();
 #endif
 
-    curl_global_init(CURL_GLOBAL_ALL);
+    // libcurl itself is initialized lazily by the first Connect, see CCurlRuntime
     m_Curl = nullptr;
-
+    m_PollCurl = nullptr;
+    m_HedgeCurl = nullptr;
+    m_InfoCurl = nullptr;
+    m_bInfoStarted = false;
+    m_bInfoPending = false;
+    m_InfoResult = CURLE_OK;
+    m_DoMulti = nullptr;
+    m_bCurlRuntime = false;
+    m_nConnectStartMs = 0;
+    m_nFirstSampleMs = -1;
+    m_nConstructionUs = int(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - tStart).count());
 }
 
 CWeatherEagle::~CWeatherEagle()
@@ -68,8 +133,6 @@ CWeatherEagle::~CWeatherEagle()
         Disconnect();
     }
 
-    curl_global_cleanup();
-
 #ifdef    PLUGIN_DEBUG
     // Close LogFile
     if(m_sLogFile.is_open())
@@ -87,71 +150,211 @@ int CWeatherEagle::Connect()
     m_sLogFile.flush();
 #endif
 
-    if(m_sIpAddress.empty())
+    std::shared_ptr<const WeatherEagleConfig> pConfig = getConfig();
+    if(pConfig->sIpAddress.empty())
         return ERR_COMMNOLINK;
 
 #if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [Connect] Base url = " << m_sBaseUrl << std::endl;
+    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [Connect] Base url = " << pConfig->sBaseUrl << std::endl;
     m_sLogFile.flush();
 #endif
 
+    m_nConnectStartMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    m_nFirstSampleMs = -1;
+
+    // first user in the process initializes libcurl
+    if(!CCurlRuntime::acquire()) {
+#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
+        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [Connect] curl_global_init failed" << std::endl;
+        m_sLogFile.flush();
+#endif
+        return ERR_CMDFAILED;
+    }
+    m_bCurlRuntime = true;
+
+    m_bAbort = false;
     m_Curl = curl_easy_init();
+    m_PollCurl = curl_easy_init();
+    m_HedgeCurl = curl_easy_init();
+    m_InfoCurl = curl_easy_init();
+    m_DoMulti = curl_multi_init();
 
-    if(!m_Curl) {
-        m_Curl = nullptr;
+    if(!m_Curl || !m_PollCurl || !m_HedgeCurl || !m_InfoCurl || !m_DoMulti) {
+        closeHandles();
 #if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
         m_sLogFile << "["<<getTimeStamp()<<"]"<< " [Connect] CURL init failed" << std::endl;
         m_sLogFile.flush();
 #endif
         return ERR_CMDFAILED;
     }
-
+    // DNS results and TLS sessions are shared with all the other devices
+    curl_easy_setopt(m_Curl, CURLOPT_SHARE, CCurlRuntime::share());
+    curl_easy_setopt(m_PollCurl, CURLOPT_SHARE, CCurlRuntime::share());
+    curl_easy_setopt(m_HedgeCurl, CURLOPT_SHARE, CCurlRuntime::share());
+    curl_easy_setopt(m_InfoCurl, CURLOPT_SHARE, CCurlRuntime::share());
+
+    // an explicit connect always gets a real attempt
+    breakerReset();
+    m_bRefreshPending = false;
     m_bIsConnected = true;
-    nErr = eagleEccoConnect();
-    if(nErr) {
+
+    if(m_bWarmStartValid) {
+        // last session's readings are already published, finish the handshake in the background
 #if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [Connect] eagleEccoConnect failed" << std::endl;
+        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [Connect] Warm start, connecting to the ECCO in the background" << std::endl;
         m_sLogFile.flush();
 #endif
-        return nErr;
+        m_WarmupThread = std::thread(&CWeatherEagle::warmupConnect, this);
+        startSinks();
+        return PLUGIN_OK;
     }
-    nErr = getData();
+
+    nErr = linkUp();
     if (nErr) {
-        curl_easy_cleanup(m_Curl);
-        m_Curl = nullptr;
+        closeHandles();
         m_bIsConnected = false;
         return nErr;
     }
-    if(!m_ThreadsAreRunning) {
-        m_exitSignal = new std::promise<void>();
-        m_futureObj = m_exitSignal->get_future();
-        m_th = std::thread(&threaded_poller, std::move(m_futureObj), this);
-        m_ThreadsAreRunning = true;
+    startSinks();
+
+    return nErr;
+}
+
+void CWeatherEagle::closeHandles()
+{
+    dropInfo();
+    if(m_Curl)
+        curl_easy_cleanup(m_Curl);
+    if(m_PollCurl)
+        curl_easy_cleanup(m_PollCurl);
+    if(m_HedgeCurl)
+        curl_easy_cleanup(m_HedgeCurl);
+    if(m_InfoCurl)
+        curl_easy_cleanup(m_InfoCurl);
+    if(m_DoMulti)
+        curl_multi_cleanup(m_DoMulti);
+    m_Curl = nullptr;
+    m_PollCurl = nullptr;
+    m_HedgeCurl = nullptr;
+    m_InfoCurl = nullptr;
+    m_DoMulti = nullptr;
+    if(m_bCurlRuntime) {
+        CCurlRuntime::release();
+        m_bCurlRuntime = false;
     }
+}
+
+// ECCO handshake, first sample and hand over to the poller
+int CWeatherEagle::linkUp()
+{
+    int nErr;
+    std::string sEcco;
 
+    nErr = eagleEccoConnect(sEcco);
+    if(nErr) {
+        dropInfo();
+#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
+        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [linkUp] eagleEccoConnect failed" << std::endl;
+        m_sLogFile.flush();
+#endif
+        return nErr;
+    }
+    nErr = probeCapabilities();
+    if (nErr) {
+        return nErr;
+    }
+    if(m_bPollerRunning) {
+        // endpoint changed while connected, the poller is already on the new url, poll it right away
+        CEaglePoller::instance().refreshDevice(this);
+        return nErr;
+    }
+    // the Connected response that ended the handshake is a fresh sample, no need for another /getecco
+    nErr = processEccoResponse(sEcco);
+    if (nErr) {
+        return nErr;
+    }
+    {
+        // periodic /getecco requests are multiplexed with the other devices on the shared poller thread,
+        // the responses are processed on the shared pipeline threads.
+        // The refresh phase is learned again, the device may have been restarted.
+        phaseReset();
+        m_sLastPollResponse.clear();
+        CEaglePipeline::instance().addDevice(this);
+        CEaglePoller::instance().addDevice(this);
+        m_bPollerRunning = true;
+    }
     return nErr;
 }
 
+void CWeatherEagle::warmupConnect()
+{
+    int nRetryMs = WARM_START_RETRY_MIN_MS;
+
+    while(true) {
+        if(linkUp() == PLUGIN_OK)
+            return;
+
+        // retry until the device answers or we're asked to disconnect
+        if(!waitOrAbort(nRetryMs))
+            return;
+        nRetryMs = std::min(nRetryMs * 2, WARM_START_RETRY_MAX_MS);
+    }
+}
+
+
+// New endpoint while connected: stop what runs against the old one and redo the
+// handshake in the background. The poller keeps the device, its next poll uses the new url.
+// The readings and the sinks (named after the device tag) belong to the old device, they
+// are dropped and the sinks restarted under the new tag.
+void CWeatherEagle::relink()
+{
+    abortTransfers();
+    if(m_WarmupThread.joinable())
+        m_WarmupThread.join();
+    {
+        const std::lock_guard<std::mutex> lock(m_AbortMutex);
+        m_bAbort = false;
+    }
+    breakerReset();
+
+    stopSinks();
+    if(m_bPollerRunning) {
+        // flush the old device samples still in the pipeline, endPoll drops the ones in flight
+        CEaglePipeline::instance().removeDevice(this);
+        CEaglePipeline::instance().addDevice(this);
+    }
+    clearSnapshot();
+    startSinks();
+
+    m_WarmupThread = std::thread(&CWeatherEagle::warmupConnect, this);
+}
 
 void CWeatherEagle::Disconnect()
 {
+    // the handshake may be waiting on the device, don't wait for its timeouts
+    abortTransfers();
+    if(m_WarmupThread.joinable())
+        m_WarmupThread.join();
+
     const std::lock_guard<std::mutex> lock(m_DevAccessMutex);
 
     if(m_bIsConnected) {
-        if(m_ThreadsAreRunning) {
+        saveWarmStartCache();
+
+        if(m_bPollerRunning) {
 #ifdef PLUGIN_DEBUG
-            m_sLogFile << "["<<getTimeStamp()<<"]"<< " [Disconnect] Waiting for threads to exit." << std::endl;
+            m_sLogFile << "["<<getTimeStamp()<<"]"<< " [Disconnect] Removing device from poller." << std::endl;
             m_sLogFile.flush();
 #endif
-            m_exitSignal->set_value();
-            m_th.join();
-            delete m_exitSignal;
-            m_exitSignal = nullptr;
-            m_ThreadsAreRunning = false;
+            // once this returns the poller no longer touches m_PollCurl and m_HedgeCurl
+            CEaglePoller::instance().removeDevice(this);
+            // and once this returns no sample of ours is left in the pipeline
+            CEaglePipeline::instance().removeDevice(this);
+            m_bPollerRunning = false;
         }
 
-        curl_easy_cleanup(m_Curl);
-        m_Curl = nullptr;
+        stopSinks();
+        closeHandles();
         m_bIsConnected = false;
 
 #ifdef PLUGIN_DEBUG
@@ -161,12 +364,18 @@ void CWeatherEagle::Disconnect()
     }
 }
 
-int CWeatherEagle::eagleEccoConnect()
+// /connectecco then /getecco until the ECCO reports Connected, sEcco is that response.
+// The capability /getinfo runs alongside on m_DoMulti, the waits between the /getecco
+// requests keep it going. No fixed delay, the retries start fast and back off.
+int CWeatherEagle::eagleEccoConnect(std::string &sEcco)
 {
     int nErr = PLUGIN_OK;
     json jResp;
     std::string response_string;
-    int nTimeout = 0;
+    WeatherEagleCapabilities Cached;
+    int nBackoffMs = ECCO_BACKOFF_MIN_MS;
+    int nLeftMs;
+    std::chrono::steady_clock::time_point tDeadline;
 
 #if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
     m_sLogFile << "["<<getTimeStamp()<<"]"<< " [eagleEccoConnect] Called." << std::endl;
@@ -177,9 +386,12 @@ int CWeatherEagle::eagleEccoConnect()
     if (nErr) {
         return nErr;
     }
-    std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+    // model and firmware for the capability probe, costs no time next to the ECCO wait
+    if(!capabilitiesCached(Cached))
+        startInfo();
 
-    while(nTimeout < MAX_CONNECT_TIMEOUT) {
+    tDeadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(ECCO_CONNECT_TIMEOUT_MS);
+    while(true) {
         nErr = doGET("/getecco", response_string);
         if(nErr) {
             return nErr;
@@ -188,18 +400,12 @@ int CWeatherEagle::eagleEccoConnect()
         // process response_string
         try {
             jResp = json::parse(response_string);
-            if(jResp.at("result").get<std::string>() == "OK") {
-                if(jResp.at("ecco").get<std::string>() == "Connected") {
-                    break;
-                }
-                else {
-                    nTimeout++;
-                    std::this_thread::sleep_for(std::chrono::milliseconds(250));
-                }
-            }
-            else {
-                nTimeout++;
-                std::this_thread::sleep_for(std::chrono::milliseconds(250));
+            if(jResp.at("result").get<std::string>() == "OK" && jResp.at("ecco").get<std::string>() == "Connected") {
+                // what this unit reports, nothing left from a previous endpoint
+                m_Caps.nEndpoints = CAP_ENDPOINT_GETECCO;
+                m_Caps.nFields = detectEccoFields(jResp);
+                sEcco.assign(response_string);
+                break;
             }
         }
         catch (json::exception& e) {
@@ -210,20 +416,24 @@ int CWeatherEagle::eagleEccoConnect()
 #endif
         }
 
-    }
-    if(nTimeout>=MAX_CONNECT_TIMEOUT) {
+        nLeftMs = int(std::chrono::duration_cast<std::chrono::milliseconds>(tDeadline - std::chrono::steady_clock::now()).count());
+        if(nLeftMs <= 0) {
 #if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [eagleEccoConnect] ECCO not responding. Not connected." << std::endl;
-        m_sLogFile.flush();
+            m_sLogFile << "["<<getTimeStamp()<<"]"<< " [eagleEccoConnect] ECCO not responding. Not connected." << std::endl;
+            m_sLogFile.flush();
 #endif
-        return ERR_NORESPONSE;
+            return ERR_NORESPONSE;
+        }
+        if(driveTransfers(nullptr, std::min(nBackoffMs, nLeftMs)) == CURLE_ABORTED_BY_CALLBACK)
+            return ERR_ABORTEDPROCESS;
+        nBackoffMs = std::min(nBackoffMs * 2, ECCO_BACKOFF_MAX_MS);
     }
     return nErr;
 }
 
 void CWeatherEagle::getFirmware(std::string &sFirmware)
 {
-    sFirmware.assign(m_sFirmware);
+    sFirmware.assign(m_Snapshot.load().szFirmware);
 }
 
 
@@ -241,18 +451,24 @@ int CWeatherEagle::doGET(std::string sCmd, std::string &sResp)
     CURLcode res;
     std::string response_string;
     std::string header_string;
+    std::shared_ptr<const WeatherEagleConfig> pConfig = getConfig();
 
     if(!m_bIsConnected)
         return NOT_CONNECTED;
 
+    // fail fast while the breaker is open, the device was unreachable very recently
+    if(!breakerAllowRequest()) {
+        return ERR_COMMNOLINK;
+    }
+
 #if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
     m_sLogFile << "["<<getTimeStamp()<<"]"<< " [doGET] Called." << std::endl;
     m_sLogFile << "["<<getTimeStamp()<<"]"<< " [doGET] Doing get on " << sCmd << std::endl;
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [doGET] Full get url " << (m_sBaseUrl+sCmd) << std::endl;
+    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [doGET] Full get url " << (pConfig->sBaseUrl+sCmd) << std::endl;
     m_sLogFile.flush();
 #endif
 
-    res = curl_easy_setopt(m_Curl, CURLOPT_URL, (m_sBaseUrl+sCmd).c_str());
+    res = setupRequest(m_Curl, pConfig->sBaseUrl+sCmd, response_string, header_string);
     if(res != CURLE_OK) { // if this fails no need to keep going
 #if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
         m_sLogFile << "["<<getTimeStamp()<<"]"<< " [doGET] curl_easy_setopt Error = " << res << std::endl;
@@ -261,28 +477,23 @@ int CWeatherEagle::doGET(std::string sCmd, std::string &sResp)
         return ERR_CMDFAILED;
     }
 
-    curl_easy_setopt(m_Curl, CURLOPT_HTTPGET, 1L);
-    curl_easy_setopt(m_Curl, CURLOPT_POST, 0L);
-    curl_easy_setopt(m_Curl, CURLOPT_SSL_VERIFYPEER, 0L);
-    curl_easy_setopt(m_Curl, CURLOPT_FOLLOWLOCATION, 1L);
-    curl_easy_setopt(m_Curl, CURLOPT_WRITEFUNCTION, writeFunction);
-    curl_easy_setopt(m_Curl, CURLOPT_WRITEDATA, &response_string);
-    curl_easy_setopt(m_Curl, CURLOPT_HEADERDATA, &header_string);
-    curl_easy_setopt(m_Curl, CURLOPT_FAILONERROR, 1);
-    curl_easy_setopt(m_Curl, CURLOPT_CONNECTTIMEOUT, 3); // 3 seconds timeout on connect
-
     // Perform the request, res will get the return code
-    res = curl_easy_perform(m_Curl);
+    res = performTransfer(m_Curl);
+    if(res == CURLE_ABORTED_BY_CALLBACK) // Disconnect, not the device's fault
+        return ERR_ABORTEDPROCESS;
     // Check for errors
     if(res != CURLE_OK) {
 #if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
         m_sLogFile << "["<<getTimeStamp()<<"]"<< " [doGET] curl_easy_perform Error = " << res << std::endl;
         m_sLogFile.flush();
 #endif
+        breakerRecordResult(res);
         if(res == CURLE_COULDNT_CONNECT)
             return ERR_COMMNOLINK;
         return ERR_CMDFAILED;
     }
+    breakerRecordResult(res);
+    recordTransferStats(m_Curl);
 
 #if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
     m_sLogFile << "["<<getTimeStamp()<<"]"<< " [doGET] response = " << response_string << std::endl;
@@ -298,258 +509,1677 @@ int CWeatherEagle::doGET(std::string sCmd, std::string &sResp)
     return nErr;
 }
 
-size_t CWeatherEagle::writeFunction(void* ptr, size_t size, size_t nmemb, void* data)
-{
-    ((std::string*)data)->append((char*)ptr, size * nmemb);
-    return size * nmemb;
-}
+#pragma mark - cancellable transfers
 
-std::string CWeatherEagle::cleanupResponse(const std::string InString, char cSeparator)
+// Same as curl_easy_perform but on our own multi handle, so abortTransfers can wake the
+// wait up and the transfer is dropped right away instead of running into its timeouts.
+CURLcode CWeatherEagle::performTransfer(CURL *pCurl)
 {
-    std::string sSegment;
-    std::vector<std::string> svFields;
+    CURLcode res;
 
-    if(!InString.size()) {
-#ifdef PLUGIN_DEBUG
-        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [cleanupResponse] InString is empty." << std::endl;
-        m_sLogFile.flush();
-#endif
-        return InString;
-    }
+    if(m_bAbort)
+        return CURLE_ABORTED_BY_CALLBACK;
+    if(curl_multi_add_handle(m_DoMulti, pCurl) != CURLM_OK)
+        return CURLE_FAILED_INIT;
 
+    res = driveTransfers(pCurl, -1);
+    // also closes the connection if the transfer was aborted half way
+    curl_multi_remove_handle(m_DoMulti, pCurl);
+    return res;
+}
 
-    std::stringstream ssTmp(InString);
+// Runs m_DoMulti until pCurl is done, or for nMs when pCurl is null.
+// The handshake /getinfo progresses meanwhile, its result is kept for collectInfo.
+CURLcode CWeatherEagle::driveTransfers(CURL *pCurl, int nMs)
+{
+    CURLcode res = CURLE_OK;
+    CURLMsg *pMsg;
+    bool bDone = false;
+    int nRunning;
+    int nMsgLeft;
+    int nWaitMs;
+    std::chrono::steady_clock::time_point tEnd = std::chrono::steady_clock::now() + std::chrono::milliseconds(std::max(nMs, 0));
+
+    while(true) {
+        if(curl_multi_perform(m_DoMulti, &nRunning) != CURLM_OK)
+            return CURLE_FAILED_INIT;
+        while((pMsg = curl_multi_info_read(m_DoMulti, &nMsgLeft))) {
+            if(pMsg->msg != CURLMSG_DONE)
+                continue;
+            if(pMsg->easy_handle == pCurl) {
+                res = pMsg->data.result;
+                bDone = true;
+            }
+            if(pMsg->easy_handle == m_InfoCurl && m_bInfoPending) {
+                m_InfoResult = pMsg->data.result;
+                m_bInfoPending = false;
+            }
+        }
+        if(bDone)
+            return res;
+        // a wakeup sent before we get here makes the poll return immediately
+        if(m_bAbort)
+            return CURLE_ABORTED_BY_CALLBACK;
+        nWaitMs = 1000;
+        if(!pCurl) {
+            nWaitMs = int(std::chrono::duration_cast<std::chrono::milliseconds>(tEnd - std::chrono::steady_clock::now()).count());
+            if(nWaitMs <= 0)
+                return CURLE_OK;
+        }
+        curl_multi_poll(m_DoMulti, NULL, 0, nWaitMs, NULL);
+    }
+}
 
-    svFields.clear();
-    // split the string into vector elements
-    while(std::getline(ssTmp, sSegment, cSeparator))
+void CWeatherEagle::abortTransfers()
+{
     {
-        if(sSegment.find("<!-") == -1)
-            svFields.push_back(sSegment);
+        const std::lock_guard<std::mutex> lock(m_AbortMutex);
+        m_bAbort = true;
     }
+    m_AbortCv.notify_all();
+    if(m_DoMulti)
+        curl_multi_wakeup(m_DoMulti);
+}
 
-    if(svFields.size()==0) {
-        return std::string("");
-    }
+bool CWeatherEagle::waitOrAbort(int nMs)
+{
+    std::unique_lock<std::mutex> lock(m_AbortMutex);
+    return !m_AbortCv.wait_for(lock, std::chrono::milliseconds(nMs), [this]{ return m_bAbort.load(); });
+}
 
-    sSegment.clear();
-    for( std::string s : svFields)
-        sSegment.append(trim(s,"\n\r "));
-    return sSegment;
+CURLcode CWeatherEagle::setupRequest(CURL *pCurl, const std::string &sUrl, std::string &sResponse, std::string &sHeader)
+{
+    CURLcode res;
+    std::shared_ptr<const WeatherEagleConfig> pConfig = getConfig();
+
+    res = curl_easy_setopt(pCurl, CURLOPT_URL, sUrl.c_str());
+    if(res != CURLE_OK)
+        return res;
+
+    curl_easy_setopt(pCurl, CURLOPT_HTTPGET, 1L);
+    curl_easy_setopt(pCurl, CURLOPT_POST, 0L);
+    curl_easy_setopt(pCurl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(pCurl, CURLOPT_WRITEFUNCTION, writeFunction);
+    curl_easy_setopt(pCurl, CURLOPT_WRITEDATA, &sResponse);
+    curl_easy_setopt(pCurl, CURLOPT_HEADERDATA, &sHeader);
+    curl_easy_setopt(pCurl, CURLOPT_FAILONERROR, 1);
+    if(m_nBreakerState == BREAKER_HALF_OPEN)
+        curl_easy_setopt(pCurl, CURLOPT_CONNECTTIMEOUT_MS, long(BREAKER_PROBE_TIMEOUT_MS)); // quick probe
+    else
+        curl_easy_setopt(pCurl, CURLOPT_CONNECTTIMEOUT_MS, long(pConfig->nConnectTimeoutMs));
+    // 0 clears a deadline left on the reused handle
+    curl_easy_setopt(pCurl, CURLOPT_TIMEOUT_MS, long(pConfig->nTransferTimeoutMs));
+
+    // keep the connection open between polls so https only pays the handshake once
+    curl_easy_setopt(pCurl, CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(pCurl, CURLOPT_TCP_KEEPIDLE, long(TCP_KEEPALIVE_IDLE_S));
+    curl_easy_setopt(pCurl, CURLOPT_TCP_KEEPINTVL, long(TCP_KEEPALIVE_INTERVAL_S));
+    curl_easy_setopt(pCurl, CURLOPT_MAXAGE_CONN, long(CONNECTION_MAX_AGE_S));
+
+    // TLS sessions are cached in the CCurlRuntime share handle, reconnects resume them
+    curl_easy_setopt(pCurl, CURLOPT_SSL_SESSIONID_CACHE, 1L);
+    curl_easy_setopt(pCurl, CURLOPT_SSL_VERIFYPEER, pConfig->Tls.bVerifyPeer ? 1L : 0L);
+    curl_easy_setopt(pCurl, CURLOPT_SSL_VERIFYHOST, pConfig->Tls.bVerifyPeer ? 2L : 0L);
+    // the pin is checked even when the chain is not verified (self signed reverse proxy)
+    if(!pConfig->Tls.sPinnedPublicKey.empty())
+        curl_easy_setopt(pCurl, CURLOPT_PINNEDPUBLICKEY, pConfig->Tls.sPinnedPublicKey.c_str());
+    else
+        curl_easy_setopt(pCurl, CURLOPT_PINNEDPUBLICKEY, NULL);
+    return CURLE_OK;
 }
 
+#pragma mark - capability probe
 
-#pragma mark - Getter / Setter
-double CWeatherEagle::getAmbianTemp()
+int CWeatherEagle::getInfo()
 {
-    return m_dTemp;
+    int nErr;
+    std::string response_string;
+
+    nErr = doGET("/getinfo", response_string);
+    if(nErr)
+        return nErr;
+    return parseInfo(response_string);
 }
 
-double CWeatherEagle::getHumidity()
+int CWeatherEagle::parseInfo(const std::string &sResp)
 {
-    return m_dPercentHumdity;
+    try {
+        m_jInfo = json::parse(sResp);
+        if(m_jInfo.at("result").get<std::string>() != "OK") {
+#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
+            m_sLogFile << "["<<getTimeStamp()<<"]"<< " [parseInfo] getinfo error : " << m_jInfo << std::endl;
+            m_sLogFile.flush();
+#endif
+            m_jInfo.clear();
+            return ERR_CMDFAILED;
+        }
+    }
+    catch (json::exception& e) {
+#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
+        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [parseInfo] json exception : " << e.what() << " - " << e.id << std::endl;
+        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [parseInfo] json exception response : " << sResp << std::endl;
+        m_sLogFile.flush();
+#endif
+        m_jInfo.clear();
+        return ERR_CMDFAILED;
+    }
+    return PLUGIN_OK;
 }
 
-double CWeatherEagle::getDewPointTemp()
+// Start the capability /getinfo without waiting for it, driveTransfers moves it along
+void CWeatherEagle::startInfo()
 {
-    return m_dDewPointTemp;
+    std::shared_ptr<const WeatherEagleConfig> pConfig = getConfig();
+
+    dropInfo();
+    if(!m_InfoCurl || !breakerAllowRequest())
+        return;
+    m_sInfoResponse.clear();
+    m_sInfoHeader.clear();
+    if(setupRequest(m_InfoCurl, pConfig->sBaseUrl+"/getinfo", m_sInfoResponse, m_sInfoHeader) != CURLE_OK)
+        return;
+    if(curl_multi_add_handle(m_DoMulti, m_InfoCurl) != CURLM_OK)
+        return;
+    m_bInfoStarted = true;
+    m_bInfoPending = true;
 }
 
-double CWeatherEagle::getBarometricPressure()
+void CWeatherEagle::dropInfo()
 {
-    return m_dBarometricPressure;
+    if(m_bInfoStarted && m_DoMulti)
+        curl_multi_remove_handle(m_DoMulti, m_InfoCurl);
+    m_bInfoStarted = false;
+    m_bInfoPending = false;
 }
 
-double CWeatherEagle::getExteSensorTemp(int nIndex)
+// Result of the /getinfo started by the handshake, a plain getInfo if there was none
+int CWeatherEagle::collectInfo()
 {
-    // <rca_portidx>=5,6,7;
-    if(nIndex<5 || nIndex>7)
-        return -273.15;
+    CURLcode res;
 
-    switch (nIndex) {
-        case 5:
-            return m_dExtTemp5;
-            break;
-        case 6:
-            return m_dExtTemp6;
-            break;
-        case 7:
-            return m_dExtTemp7;
-            break;
+    if(!m_bInfoStarted)
+        return getInfo();
 
-        default:
-            return -273.15;
-            break;
+    if(m_bInfoPending) {
+        res = driveTransfers(m_InfoCurl, -1);
+        if(m_bInfoPending) { // aborted
+            dropInfo();
+            return res == CURLE_ABORTED_BY_CALLBACK ? ERR_ABORTEDPROCESS : ERR_CMDFAILED;
+        }
+    }
+    res = m_InfoResult;
+    dropInfo();
+
+    breakerRecordResult(res);
+    if(res == CURLE_ABORTED_BY_CALLBACK)
+        return ERR_ABORTEDPROCESS;
+    if(res != CURLE_OK) {
+#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
+        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [collectInfo] /getinfo transfer Error = " << res << std::endl;
+        m_sLogFile.flush();
+#endif
+        return res == CURLE_COULDNT_CONNECT ? ERR_COMMNOLINK : ERR_CMDFAILED;
     }
+    recordTransferStats(m_InfoCurl);
+    return parseInfo(cleanupResponse(m_sInfoResponse, '\n'));
 }
 
-int CWeatherEagle::getData()
+int CWeatherEagle::getModelName()
 {
     int nErr = PLUGIN_OK;
-    json jResp;
-    std::string response_string;
-    std::string WeatherEagleError;
 
-    if(!m_bIsConnected || !m_Curl)
-        return ERR_COMMNOLINK;
+    if(m_jInfo.is_null() && (nErr = getInfo()))
+        return nErr;
 
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [getData] Called." << std::endl;
-    m_sLogFile.flush();
-#endif
-    if(m_sFirmware.empty()) {
-        // do http GET request to local server to get firmware info
-        nErr = doGET("/getinfo", response_string);
-        if(!nErr) {
-            // process response_string
-            try {
-                jResp = json::parse(response_string);
-                if(jResp.at("result").get<std::string>() == "OK") {
-                    m_sFirmware = jResp.at("firmwareversion").get<std::string>();
-                }
-                else {
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-                    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [getData] getinfo error : " << jResp << std::endl;
-                    m_sLogFile.flush();
-#endif
-                }
-            }
-            catch (json::exception& e) {
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-                m_sLogFile << "["<<getTimeStamp()<<"]"<< " [getData] json exception : " << e.what() << " - " << e.id << std::endl;
-                m_sLogFile << "["<<getTimeStamp()<<"]"<< " [getData] json exception response : " << response_string << std::endl;
-                m_sLogFile.flush();
-#endif
-            }
-        }
-    }
+    // not all firmwares report the model
+    if(m_jInfo.contains("model") && m_jInfo["model"].is_string())
+        m_sModel = m_jInfo["model"].get<std::string>();
+    else
+        m_sModel = "Eagle Manager X";
+    return nErr;
+}
 
+int CWeatherEagle::getFirmwareVersion()
+{
+    int nErr = PLUGIN_OK;
 
-    // do http GET request to local server environmental data
-    nErr = doGET("/getecco", response_string);
-    if(nErr) {
+    if(m_jInfo.is_null() && (nErr = getInfo()))
         return nErr;
-    }
 
-    // process response_string
     try {
-        jResp = json::parse(response_string);
-        if(jResp.at("result").get<std::string>() == "OK") {
-            if(jResp.at("ecco").get<std::string>() == "Connected") {
-                m_dTemp = jResp.at("temp").get<double>();
-                m_dPercentHumdity = jResp.at("hum").get<double>();
-                m_dBarometricPressure = jResp.at("pressure").get<double>();
-                m_dDewPointTemp = jResp.at("dew").get<double>();
-                m_dExtTemp5 = jResp.at("temp5").get<double>();
-                m_dExtTemp6 = jResp.at("temp6").get<double>();
-                m_dExtTemp7 = jResp.at("temp7").get<double>();
-            }
-        }
-        else {
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-            m_sLogFile << "["<<getTimeStamp()<<"]"<< " [getData] getecco error : " << jResp << std::endl;
-            m_sLogFile.flush();
-#endif
-            return ERR_CMDFAILED;
-        }
+        m_sFirmware = m_jInfo.at("firmwareversion").get<std::string>();
+        m_dFirmwareVersion = atof(m_sFirmware.c_str());
     }
     catch (json::exception& e) {
 #if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [getData] json exception : " << e.what() << " - " << e.id << std::endl;
-        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [getData] json exception response : " << response_string << std::endl;
+        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [getFirmwareVersion] json exception : " << e.what() << " - " << e.id << std::endl;
         m_sLogFile.flush();
 #endif
         return ERR_CMDFAILED;
     }
-
-
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [getData] m_dTemp                : " << m_dTemp << std::endl;
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [getData] m_dPercentHumdity      : " << m_dPercentHumdity << std::endl;
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [getData] m_dBarometricPressure  : " << m_dBarometricPressure << std::endl;
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [getData] m_dDewPointTemp        : " << m_dDewPointTemp << std::endl;
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [getData] m_sFirmware            : " << m_sFirmware << std::endl;
-    m_sLogFile.flush();
-#endif
-
     return nErr;
 }
 
+uint32_t CWeatherEagle::detectEccoFields(const json &jEcco)
+{
+    uint32_t nFields = 0;
 
-#pragma mark - Getter / Setter
+    for(int i = 0; i < FIELD_COUNT; i++) {
+        if(jEcco.contains(EccoFields[i].pszKey) && jEcco[EccoFields[i].pszKey].is_number())
+            nFields |= (1 << i);
+    }
+    return nFields;
+}
 
+void CWeatherEagle::setPollFields(uint32_t nFields)
+{
+    m_nPollFields = nFields & ((1 << FIELD_COUNT) - 1);
+}
 
-void CWeatherEagle::getIpAddress(std::string &IpAddress)
+// probed less than CAPABILITY_TTL_MS ago, by this or another device on the same url
+bool CWeatherEagle::capabilitiesCached(WeatherEagleCapabilities &Caps)
 {
-    IpAddress = m_sIpAddress;
+    int64_t nNowMs;
+    std::string sBaseUrl;
+
+    getBaseUrl(sBaseUrl);
+    nNowMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    return CWeatherEagleRegistry::getCapabilities(sBaseUrl, Caps) && (nNowMs - Caps.nProbeTimeMs) < CAPABILITY_TTL_MS;
 }
 
-void CWeatherEagle::setIpAddress(std::string IpAddress)
+// Model, firmware, endpoints and the /getecco fields. A fresh cache entry of the url with
+// the fields of the handshake /getecco skips /getinfo. A unit replaced at the same address
+// with other fields is probed again, a field missing from a poll drops the entry.
+// Must be called after eagleEccoConnect, which records the fields of the first Connected response.
+int CWeatherEagle::probeCapabilities()
 {
-    m_sIpAddress = IpAddress;
-    if(m_nTcpPort!=80 && m_nTcpPort!=443) {
-        m_sBaseUrl = "http://"+m_sIpAddress+":"+std::to_string(m_nTcpPort);
-    }
-    else if (m_nTcpPort==443) {
-        m_sBaseUrl = "https://"+m_sIpAddress;
+    WeatherEagleCapabilities Caps;
+    WeatherEagleCapabilities Cached;
+    int64_t nNowMs;
+    std::string sBaseUrl;
+
+    getBaseUrl(sBaseUrl);
+    nNowMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+
+    Caps = m_Caps; // endpoints and fields from the ECCO handshake
+    if(capabilitiesCached(Cached) && Cached.nFields == Caps.nFields) {
+        dropInfo();
+        m_Caps = Cached;
     }
     else {
-        m_sBaseUrl = "http://"+m_sIpAddress;
+        m_jInfo.clear();
+        m_sModel.clear();
+        m_sFirmware.clear();
+        m_dFirmwareVersion = 0.0;
+        if(collectInfo() == PLUGIN_OK) {
+            Caps.nEndpoints |= CAP_ENDPOINT_GETINFO;
+            getModelName();
+            getFirmwareVersion();
+        }
+        Caps.sModel = m_sModel;
+        Caps.sFirmware = m_sFirmware;
+        Caps.dFirmwareVersion = m_dFirmwareVersion;
+        Caps.nProbeTimeMs = nNowMs;
+        // don't cache a failed /getinfo, try again on the next connect
+        if(Caps.nEndpoints & CAP_ENDPOINT_GETINFO)
+            CWeatherEagleRegistry::setCapabilities(sBaseUrl, Caps);
+        m_Caps = Caps;
     }
+
+    m_sModel = m_Caps.sModel;
+    m_sFirmware = m_Caps.sFirmware;
+    m_dFirmwareVersion = m_Caps.dFirmwareVersion;
+    {
+        // the pipeline stamps the snapshots with these
+        const std::lock_guard<std::mutex> lock(m_PublishMutex);
+        m_sPublishedModel = m_sModel;
+        m_sPublishedFirmware = m_sFirmware;
+    }
+    if(!(m_Caps.nEndpoints & CAP_ENDPOINT_GETECCO) || !m_Caps.nFields)
+        return ERR_CMDFAILED;
+    setPollFields(m_Caps.nFields);
+
 #if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [setIpAddress] New base url : " << m_sBaseUrl << std::endl;
+    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [probeCapabilities] model " << m_sModel << " firmware " << m_sFirmware << " fields 0x" << std::hex << m_Caps.nFields << std::dec << std::endl;
     m_sLogFile.flush();
 #endif
-
+    return PLUGIN_OK;
 }
 
-void CWeatherEagle::getTcpPort(int &nTcpPort)
+void CWeatherEagle::getCapabilities(WeatherEagleCapabilities &Caps)
 {
-    nTcpPort = m_nTcpPort;
+    Caps = m_Caps;
 }
 
-void CWeatherEagle::setTcpPort(int nTcpPort)
+#pragma mark - poller interface
+
+CURL* CWeatherEagle::beginPoll()
 {
-    m_nTcpPort = nTcpPort;
-    if(m_nTcpPort!=80) {
-        m_sBaseUrl = "http://"+m_sIpAddress+":"+std::to_string(m_nTcpPort);
+    std::shared_ptr<const WeatherEagleConfig> pConfig = getConfig();
+
+    if(!m_bIsConnected || !m_PollCurl) {
+        refreshCompleted();
+        return nullptr;
     }
-    else {
-        m_sBaseUrl = "http://"+m_sIpAddress;
+
+    // fail fast while the breaker is open, the poller will come back at the next cadence
+    if(!breakerAllowRequest()) {
+        refreshCompleted();
+        return nullptr;
     }
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [setTcpPort] New base url : " << m_sBaseUrl << std::endl;
-    m_sLogFile.flush();
-#endif
+
+    if(pConfig->sBaseUrl != m_sPollBaseUrl) {
+        // different device, what was learned about the old one doesn't apply
+        phaseReset();
+        m_sLastPollResponse.clear();
+        m_sPollBaseUrl = pConfig->sBaseUrl;
+        m_nPollLatencyCount = 0;
+        m_nPollLatencyPos = 0;
+        m_nHedgeDelayMs = -1;
+    }
+
+    m_sPollResponse.clear();
+    m_sPollHeader.clear();
+    m_nPollStartMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    if(setupRequest(m_PollCurl, pConfig->sBaseUrl+"/getecco", m_sPollResponse, m_sPollHeader) != CURLE_OK) {
+        refreshCompleted();
+        return nullptr;
+    }
+    m_nPolls++;
+    return m_PollCurl;
 }
 
-std::string& CWeatherEagle::trim(std::string &str, const std::string& filter )
+// Second request for the poll in flight, the poller takes whichever answers first.
+CURL* CWeatherEagle::beginHedge()
 {
-    return ltrim(rtrim(str, filter), filter);
+    std::shared_ptr<const WeatherEagleConfig> pConfig = getConfig();
+    bool bSecondary = !pConfig->sHedgeUrl.empty();
+
+    if(!m_HedgeCurl || !pConfig->bHedging)
+        return nullptr;
+
+    m_sHedgeResponse.clear();
+    m_sHedgeHeader.clear();
+    if(setupRequest(m_HedgeCurl, (bSecondary ? pConfig->sHedgeUrl : pConfig->sBaseUrl)+"/getecco", m_sHedgeResponse, m_sHedgeHeader) != CURLE_OK)
+        return nullptr;
+    // the slow request may be stuck on its connection, don't queue behind it
+    curl_easy_setopt(m_HedgeCurl, CURLOPT_FRESH_CONNECT, bSecondary ? 0L : 1L);
+    m_nHedges++;
+    return m_HedgeCurl;
 }
 
-std::string& CWeatherEagle::ltrim(std::string& str, const std::string& filter)
+// poll start to hedge, -1 if the poll should not be hedged
+int CWeatherEagle::getHedgeDelayMs()
 {
-    str.erase(0, str.find_first_not_of(filter));
-    return str;
+    if(!getConfig()->bHedging)
+        return -1;
+    return m_nHedgeDelayMs;
 }
 
-std::string& CWeatherEagle::rtrim(std::string& str, const std::string& filter)
+void CWeatherEagle::recordPollLatency(int nMs)
 {
-    str.erase(str.find_last_not_of(filter) + 1);
-    return str;
+    int nSorted[HEDGE_LATENCY_SAMPLES];
+    int nIndex;
+
+    m_nPollLatencyMs[m_nPollLatencyPos] = nMs;
+    m_nPollLatencyPos = (m_nPollLatencyPos + 1) % HEDGE_LATENCY_SAMPLES;
+    if(m_nPollLatencyCount < HEDGE_LATENCY_SAMPLES)
+        m_nPollLatencyCount++;
+    if(m_nPollLatencyCount < HEDGE_MIN_SAMPLES)
+        return;
+
+    memcpy(nSorted, m_nPollLatencyMs, m_nPollLatencyCount * sizeof(int));
+    nIndex = (m_nPollLatencyCount * HEDGE_PERCENTILE) / 100;
+    std::nth_element(nSorted, nSorted + nIndex, nSorted + m_nPollLatencyCount);
+    m_nHedgeDelayMs = std::max(nSorted[nIndex], HEDGE_MIN_DELAY_MS);
 }
 
-std::string CWeatherEagle::findField(std::vector<std::string> &svFields, const std::string& token)
+// pEasy is the handle that answered, m_PollCurl or m_HedgeCurl
+void CWeatherEagle::endPoll(CURLcode res, CURL *pEasy)
 {
-    for(int i=0; i<svFields.size(); i++){
-        if(svFields[i].find(token)!= -1) {
-            return svFields[i];
+    bool bChanged;
+    int64_t nNowMs;
+
+    // started before a relink, the answer comes from the old device
+    if(m_sPollBaseUrl != getConfig()->sBaseUrl) {
+        refreshCompleted();
+        return;
+    }
+    breakerRecordResult(res);
+    if(res == CURLE_OK) {
+        recordTransferStats(pEasy);
+        // when the hedge wins this is a lower bound of the first request latency, still what we want to beat
+        nNowMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        recordPollLatency(int(nNowMs - m_nPollStartMs));
+        if(pEasy == m_HedgeCurl) {
+            m_nHedgeWins++;
+            m_sPollResponse.swap(m_sHedgeResponse);
         }
     }
-    return std::string();
-}
-
+    if(res != CURLE_OK) {
+#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
+        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [endPoll] transfer Error = " << res << std::endl;
+        m_sLogFile.flush();
+#endif
+        refreshCompleted();
+        return;
+    }
+    // same bytes as last time, the device hasn't refreshed its sensors yet
+    bChanged = m_sPollResponse != m_sLastPollResponse;
+    phaseObserve(bChanged, m_nPollStartMs);
+    // Only skipped if the previous copy was parsed and stored (a "Not connected" or
+    // invalid body never is) and no reader is waiting for a refresh. The timestamps are
+    // left alone, the age of the data is the same for X2 and every sink.
+    if(!bChanged && m_nPollStartMs - m_nLastPublishedPollMs < DUPLICATE_MAX_AGE_MS &&
+       m_nLastGoodDataMs >= m_nLastPublishedPollMs && !m_bRefreshPending) {
+        m_nDuplicateSamples++;
+        refreshCompleted(); // a refresh asked for while this poll was running
+        return;
+    }
+    m_sLastPollResponse = m_sPollResponse;
+    m_nLastPublishedPollMs = m_nPollStartMs;
+
+    // parsing and publishing happen on the pipeline threads, which also signal the on demand readers
+    if(!CEaglePipeline::instance().submit(this, m_sPollResponse))
+        refreshCompleted();
+}
+
+#pragma mark - phase locked polling
+
+// The Eagle refreshes its readings on its own clock. A poll that returns a new response right
+// after one that didn't brackets a refresh edge, the spacing of these edges gives the period.
+// The period is learned with a short burst of fast polls, the next polls are then placed just
+// after each predicted refresh. Locked polls creep earlier until one comes too early, which is
+// retried shortly after to find the edge again.
+void CWeatherEagle::phaseObserve(bool bChanged, int64_t nPollMs)
+{
+    int64_t nEdgeMs;
+    int64_t nDiffMs;
+    int nPeriodMs = m_nPhasePeriodMs;
+    int nSampleMs;
+    int k;
+
+    if(m_bPhaseGaveUp)
+        return;
+
+    if(!m_nPhasePrevPollMs) {
+        m_nPhaseLearnStartMs = nPollMs;
+        m_nPhasePrevPollMs = nPollMs;
+        m_bPhasePrevChanged = bChanged;
+        return;
+    }
+
+    if(!bChanged) {
+        if(m_bPhaseLocked) {
+            // came too early, or the readings didn't move at all this period
+            if(m_nPhaseRetries < PHASE_MAX_RETRIES) {
+                m_nPhaseRetries++;
+                m_bPhaseRetry = true;
+            }
+            else {
+                m_bPhaseRetry = false;
+                m_nPhaseRetries = 0;
+                m_nPhaseEdgeMs += nPeriodMs;
+                if(++m_nPhaseMisses >= PHASE_MAX_MISSES)
+                    phaseReset();
+            }
+        }
+        m_nPhasePrevPollMs = nPollMs;
+        m_bPhasePrevChanged = false;
+        return;
+    }
+
+    m_bPhaseRetry = false;
+    m_nPhaseRetries = 0;
+    m_nPhaseMisses = 0;
+
+    if(m_bPhasePrevChanged) {
+        // no tight bracket, assume the edge came where it was predicted, a bit earlier
+        if(m_bPhaseLocked)
+            m_nPhaseEdgeMs = std::max(m_nPhasePrevPollMs, nPollMs - PHASE_GUARD_MS - PHASE_CREEP_MS);
+        m_nPhasePrevPollMs = nPollMs;
+        return;
+    }
+
+    // the refresh happened between the previous (unchanged) poll and this one
+    nEdgeMs = (m_nPhasePrevPollMs + nPollMs) / 2;
+    if(m_nPhaseBracketedEdgeMs) {
+        nDiffMs = nEdgeMs - m_nPhaseBracketedEdgeMs;
+        // edges we didn't see (readings that didn't move) count as whole periods,
+        // a much shorter spacing means the estimate itself was a multiple
+        k = nPeriodMs ? std::max(1, int((nDiffMs + nPeriodMs / 2) / nPeriodMs)) : 1;
+        nSampleMs = int(nDiffMs / k);
+        if(!nPeriodMs || nSampleMs < nPeriodMs * 3 / 4)
+            nPeriodMs = nSampleMs;
+        else
+            nPeriodMs = (3 * nPeriodMs + nSampleMs) / 4;
+        m_nPhasePeriodMs = nPeriodMs;
+        m_nPhaseSamples++;
+        if(!m_bPhaseLocked && m_nPhaseSamples >= PHASE_LOCK_SAMPLES && nPeriodMs >= PHASE_MIN_PERIOD_MS) {
+            m_bPhaseLocked = true;
+#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
+            m_sLogFile << "["<<getTimeStamp()<<"]"<< " [phaseObserve] locked on a " << nPeriodMs << " ms refresh period" << std::endl;
+            m_sLogFile.flush();
+#endif
+        }
+    }
+    m_nPhaseBracketedEdgeMs = nEdgeMs;
+    m_nPhaseEdgeMs = nEdgeMs;
+    m_nPhasePrevPollMs = nPollMs;
+    m_bPhasePrevChanged = true;
+}
+
+void CWeatherEagle::phaseReset()
+{
+    m_nPhasePrevPollMs = 0;
+    m_bPhasePrevChanged = false;
+    m_nPhaseEdgeMs = 0;
+    m_nPhaseBracketedEdgeMs = 0;
+    m_nPhaseLearnStartMs = 0;
+    m_nPhaseSamples = 0;
+    m_nPhaseRetries = 0;
+    m_nPhaseMisses = 0;
+    m_bPhaseRetry = false;
+    m_bPhaseGaveUp = false;
+    m_nPhasePeriodMs = 0;
+    m_bPhaseLocked = false;
+}
+
+// Delay before the next regular poll, called by the poller once a transfer completed.
+// Locked devices are polled at the first predicted refresh past about one interval from now,
+// so the request rate stays close to the nominal one.
+int CWeatherEagle::nextPollDelayMs()
+{
+    int nIntervalMs = getPollIntervalMs();
+    int64_t nNowMs;
+    int64_t nTargetMs;
+    int64_t nEarliestMs;
+    int nPeriodMs = m_nPhasePeriodMs;
+
+    nNowMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+
+    if(m_bPhaseGaveUp) {
+        // no usable period (faster than PHASE_MIN_PERIOD_MS or readings too stable), try again later
+        if(nNowMs - m_nPhaseLearnStartMs >= PHASE_RELEARN_MS)
+            phaseReset();
+        return nIntervalMs;
+    }
+
+    if(!m_bPhaseLocked) {
+        if(m_nPhaseLearnStartMs && nNowMs - m_nPhaseLearnStartMs >= PHASE_LEARN_MAX_MS) {
+            m_bPhaseGaveUp = true;
+            return nIntervalMs;
+        }
+        return std::min(nIntervalMs, std::max(nIntervalMs / PHASE_LEARN_SPEEDUP, PHASE_LEARN_MIN_POLL_MS));
+    }
+
+    if(m_bPhaseRetry)
+        return PHASE_RETRY_MS;
+
+    nEarliestMs = nNowMs + std::max<int64_t>(PHASE_MIN_GAP_MS, nIntervalMs - nPeriodMs / 2);
+    nTargetMs = m_nPhaseEdgeMs + PHASE_GUARD_MS;
+    if(nTargetMs < nEarliestMs)
+        nTargetMs += ((nEarliestMs - nTargetMs + nPeriodMs - 1) / nPeriodMs) * nPeriodMs;
+    return int(nTargetMs - nNowMs);
+}
+
+#pragma mark - on demand refresh
+
+int CWeatherEagle::getDataAge()
+{
+    int64_t nLastGood = m_nLastGoodDataMs;
+    int64_t nNow;
+
+    if(nLastGood < 0)
+        return -1;
+    nNow = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    return int(nNow - nLastGood);
+}
+
+// If the data is older than nStaleThresholdMs start one background poll, shared by all
+// concurrent callers, and optionally wait up to nMaxWaitMs for it.
+// Never touches m_DevAccessMutex. Returns true if the data is fresh on return.
+bool CWeatherEagle::refreshIfStale(int nStaleThresholdMs, int nMaxWaitMs)
+{
+    int nAge;
+    uint64_t nSeq;
+    uint64_t nCancelGen;
+    bool bExpected = false;
+
+    nAge = getDataAge();
+    if(nAge >= 0 && nAge <= nStaleThresholdMs)
+        return true;
+
+    if(!m_bIsConnected || !m_bPollerRunning)
+        return false;
+
+    nSeq = m_nSampleSeq;
+    // single flight, only the first caller queues a request
+    if(m_bRefreshPending.compare_exchange_strong(bExpected, true)) {
+        if(!CEaglePoller::instance().refreshDevice(this)) {
+            m_bRefreshPending = false;
+            return false;
+        }
+    }
+
+    if(nMaxWaitMs <= 0)
+        return false;
+
+    nMaxWaitMs = std::min(nMaxWaitMs, MAX_REFRESH_WAIT_MS);
+    std::unique_lock<std::mutex> lock(m_RefreshMutex);
+    nCancelGen = m_nRefreshCancelGen;
+    m_RefreshDone.wait_for(lock, std::chrono::milliseconds(nMaxWaitMs), [this, nCancelGen]{ return !m_bRefreshPending || m_nRefreshCancelGen != nCancelGen; });
+    return m_nSampleSeq != nSeq;
+}
+
+// Release the readers waiting in refreshIfStale, used when a plugin instance unlinks
+void CWeatherEagle::cancelRefreshWaits()
+{
+    {
+        const std::lock_guard<std::mutex> lock(m_RefreshMutex);
+        m_nRefreshCancelGen++;
+    }
+    m_RefreshDone.notify_all();
+}
+
+void CWeatherEagle::refreshCompleted()
+{
+    if(!m_bRefreshPending)
+        return;
+    {
+        const std::lock_guard<std::mutex> lock(m_RefreshMutex);
+        m_bRefreshPending = false;
+    }
+    m_RefreshDone.notify_all();
+}
+
+#pragma mark - circuit breaker
+
+bool CWeatherEagle::breakerAllowRequest()
+{
+    if(m_nBreakerState == BREAKER_CLOSED)
+        return true;
+
+    const std::lock_guard<std::mutex> lock(m_BreakerMutex);
+
+    if(m_nBreakerState == BREAKER_OPEN) {
+        if(std::chrono::steady_clock::now() < m_tBreakerRetryAt) {
+            m_nBreakerFastFails++;
+            return false;
+        }
+        // open period is over, let one probe through
+        m_nBreakerState = BREAKER_HALF_OPEN;
+        m_nBreakerProbes++;
+#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
+        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [breakerAllowRequest] Breaker half-open, probing device." << std::endl;
+        m_sLogFile.flush();
+#endif
+    }
+    return true;
+}
+
+void CWeatherEagle::breakerRecordResult(CURLcode res)
+{
+    switch(res) {
+        case CURLE_OK:
+            breakerRecordSuccess();
+            break;
+        // transport level failures, the device is not reachable
+        case CURLE_COULDNT_RESOLVE_HOST:
+        case CURLE_COULDNT_CONNECT:
+        case CURLE_OPERATION_TIMEDOUT:
+        case CURLE_SEND_ERROR:
+        case CURLE_RECV_ERROR:
+        case CURLE_GOT_NOTHING:
+            breakerRecordFailure();
+            break;
+        // the device answered, even if with an error
+        default:
+            breakerRecordSuccess();
+            break;
+    }
+}
+
+void CWeatherEagle::breakerRecordSuccess()
+{
+    if(m_nBreakerState != BREAKER_CLOSED) {
+#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
+        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [breakerRecordSuccess] Probe succeeded, breaker closed." << std::endl;
+        m_sLogFile.flush();
+#endif
+    }
+    m_nBreakerState = BREAKER_CLOSED;
+    m_nConsecutiveFailures = 0;
+    m_nBackoffMs = 0;
+}
+
+void CWeatherEagle::breakerRecordFailure()
+{
+    int nBackoff;
+    int nJitter;
+    const std::lock_guard<std::mutex> lock(m_BreakerMutex);
+
+    m_nConsecutiveFailures++;
+
+    if(m_nBreakerState == BREAKER_CLOSED && m_nConsecutiveFailures < BREAKER_FAILURE_THRESHOLD)
+        return;
+
+    // trip (or re-trip after a failed probe) with exponential backoff
+    if(m_nBackoffMs == 0)
+        nBackoff = BREAKER_BASE_BACKOFF_MS;
+    else
+        nBackoff = std::min(m_nBackoffMs * 2, BREAKER_MAX_BACKOFF_MS);
+    m_nBackoffMs = nBackoff;
+
+    // spread the probes so several plugins don't hit a waking device at the same time
+    std::uniform_int_distribution<int> jitter(-(nBackoff * BREAKER_JITTER_PERCENT / 100), (nBackoff * BREAKER_JITTER_PERCENT / 100));
+    nJitter = jitter(m_BreakerRng);
+
+    m_tBreakerRetryAt = std::chrono::steady_clock::now() + std::chrono::milliseconds(nBackoff + nJitter);
+    m_nBreakerState = BREAKER_OPEN;
+    m_nBreakerTrips++;
+
+#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
+    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [breakerRecordFailure] Breaker open for " << (nBackoff + nJitter) << " ms after " << m_nConsecutiveFailures << " failures." << std::endl;
+    m_sLogFile.flush();
+#endif
+}
+
+void CWeatherEagle::breakerReset()
+{
+    const std::lock_guard<std::mutex> lock(m_BreakerMutex);
+
+    m_nBreakerState = BREAKER_CLOSED;
+    m_nConsecutiveFailures = 0;
+    m_nBackoffMs = 0;
+    m_nBreakerTrips = 0;
+    m_nBreakerFastFails = 0;
+    m_nBreakerProbes = 0;
+    m_tBreakerRetryAt = std::chrono::steady_clock::now();
+}
+
+void CWeatherEagle::getMetrics(WeatherEagleMetrics &Metrics)
+{
+    Metrics.nBreakerState = m_nBreakerState;
+    Metrics.nBreakerTrips = m_nBreakerTrips;
+    Metrics.nBreakerFastFails = m_nBreakerFastFails;
+    Metrics.nBreakerProbes = m_nBreakerProbes;
+    Metrics.nConsecutiveFailures = m_nConsecutiveFailures;
+    Metrics.nCurrentBackoffMs = m_nBackoffMs;
+    Metrics.nLatencyMs = m_nLatencyMs;
+    Metrics.nConstructionUs = m_nConstructionUs;
+    Metrics.nFirstSampleMs = m_nFirstSampleMs;
+    Metrics.nNewConnections = m_nNewConnections;
+    Metrics.nReusedConnections = m_nReusedConnections;
+    Metrics.nTlsHandshakes = m_nTlsHandshakes;
+    Metrics.nTlsHandshakeUs = m_nTlsHandshakeUs;
+    Metrics.nLastTlsHandshakeUs = m_nLastTlsHandshakeUs;
+    Metrics.nSamples = m_nSamples;
+    Metrics.nUnchangedSamples = m_nUnchangedSamples;
+    Metrics.dSuppressionRatio = Metrics.nSamples ? double(Metrics.nUnchangedSamples) / double(Metrics.nSamples) : 0.0;
+    Metrics.nDuplicateSamples = m_nDuplicateSamples;
+    Metrics.nRefreshPeriodMs = m_nPhasePeriodMs;
+    Metrics.bPhaseLocked = m_bPhaseLocked;
+    Metrics.nPolls = m_nPolls;
+    Metrics.nHedges = m_nHedges;
+    Metrics.nHedgeWins = m_nHedgeWins;
+    Metrics.nHedgeDenied = m_nHedgeDenied;
+    Metrics.dHedgeRate = Metrics.nPolls ? double(Metrics.nHedges) / double(Metrics.nPolls) : 0.0;
+    Metrics.nHedgeDelayMs = m_nHedgeDelayMs;
+}
+
+void CWeatherEagle::recordTransferStats(CURL *pCurl)
+{
+    curl_off_t nTotalUs = 0;
+    curl_off_t nConnectUs = 0;
+    curl_off_t nAppConnectUs = 0;
+    long nConnects = 0;
+    int nMs;
+    int nHandshakeUs;
+
+    if(curl_easy_getinfo(pCurl, CURLINFO_TOTAL_TIME_T, &nTotalUs) == CURLE_OK) {
+        nMs = int(nTotalUs / 1000);
+        // exponentially weighted, 1/4 of the new sample
+        m_nLatencyMs = m_nLatencyMs ? (3 * m_nLatencyMs + nMs) / 4 : std::max(nMs, 1);
+    }
+
+    if(curl_easy_getinfo(pCurl, CURLINFO_NUM_CONNECTS, &nConnects) != CURLE_OK)
+        return;
+    if(!nConnects) {
+        m_nReusedConnections++;
+        return;
+    }
+    m_nNewConnections++;
+
+    // appconnect is only set when a TLS handshake took place on this transfer
+    curl_easy_getinfo(pCurl, CURLINFO_CONNECT_TIME_T, &nConnectUs);
+    curl_easy_getinfo(pCurl, CURLINFO_APPCONNECT_TIME_T, &nAppConnectUs);
+    if(nAppConnectUs <= 0)
+        return;
+    nHandshakeUs = int(std::max<curl_off_t>(nAppConnectUs - nConnectUs, 1));
+    m_nTlsHandshakes++;
+    m_nLastTlsHandshakeUs = nHandshakeUs;
+    m_nTlsHandshakeUs = m_nTlsHandshakeUs ? (3 * m_nTlsHandshakeUs + nHandshakeUs) / 4 : nHandshakeUs;
+}
+
+#pragma mark - warm start cache
+
+typedef struct {
+    uint32_t                nMagic;
+    uint32_t                nVersion;
+    uint32_t                nSize;
+    int32_t                 nLatencyMs;
+    WeatherEagleSnapshot    Snapshot;
+} WarmStartCacheFile;
+
+std::string CWeatherEagle::getWarmStartCachePath()
+{
+    std::string sPath;
+    const char *pszHome;
+
+#if defined(SB_WIN_BUILD)
+    pszHome = getenv("HOMEDRIVE");
+    sPath = pszHome ? pszHome : "";
+    pszHome = getenv("HOMEPATH");
+    sPath += pszHome ? pszHome : "";
+    sPath += "\\";
+#else
+    pszHome = getenv("HOME");
+    if(!pszHome)
+        return std::string();
+    sPath = pszHome;
+    sPath += "/";
+#endif
+    // one cache per device
+    sPath += "X2_WeatherEagle_" + getDeviceTag() + ".cache";
+    return sPath;
+}
+
+bool CWeatherEagle::saveWarmStartCache()
+{
+    WarmStartCacheFile Cache;
+    std::string sPath = getWarmStartCachePath();
+    std::string sTmpPath = sPath + ".tmp";
+
+    memset(&Cache, 0, sizeof(Cache));
+    Cache.Snapshot = m_Snapshot.load();
+    if(sPath.empty() || !Cache.Snapshot.nSeq)
+        return false;
+
+    Cache.nMagic = WARM_START_MAGIC;
+    Cache.nVersion = WARM_START_VERSION;
+    Cache.nSize = sizeof(Cache);
+    Cache.nLatencyMs = m_nLatencyMs;
+
+    std::ofstream CacheFile(sTmpPath, std::ios::out | std::ios::binary | std::ios::trunc);
+    if(!CacheFile.is_open())
+        return false;
+    CacheFile.write((const char *)&Cache, sizeof(Cache));
+    CacheFile.close();
+    if(CacheFile.fail())
+        return false;
+
+#if defined(SB_WIN_BUILD)
+    remove(sPath.c_str()); // rename doesn't replace on Windows
+#endif
+    if(rename(sTmpPath.c_str(), sPath.c_str()) != 0)
+        return false;
+
+#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
+    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [saveWarmStartCache] saved to " << sPath << std::endl;
+    m_sLogFile.flush();
+#endif
+    return true;
+}
+
+// Publish the readings saved by the previous session, flagged as warm start and with their real age.
+bool CWeatherEagle::loadWarmStartCache()
+{
+    WarmStartCacheFile Cache;
+    std::string sPath = getWarmStartCachePath();
+    int64_t nAgeMs;
+    int64_t nNowWallMs;
+    int64_t nNowMs;
+
+    m_bWarmStartValid = false;
+    if(sPath.empty())
+        return false;
+
+    std::ifstream CacheFile(sPath, std::ios::in | std::ios::binary);
+    if(!CacheFile.is_open())
+        return false;
+    CacheFile.read((char *)&Cache, sizeof(Cache));
+    if(CacheFile.gcount() != sizeof(Cache))
+        return false;
+    if(Cache.nMagic != WARM_START_MAGIC || Cache.nVersion != WARM_START_VERSION || Cache.nSize != sizeof(Cache))
+        return false;
+
+    nNowWallMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    nNowMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    nAgeMs = nNowWallMs - Cache.Snapshot.nWallTimeMs;
+    if(nAgeMs < 0 || nAgeMs > WARM_START_MAX_AGE_MS)
+        return false;
+
+    Cache.Snapshot.szFirmware[sizeof(Cache.Snapshot.szFirmware)-1] = 0;
+    Cache.Snapshot.szModel[sizeof(Cache.Snapshot.szModel)-1] = 0;
+    Cache.Snapshot.nFlags |= SNAPSHOT_FLAG_WARM_START;
+    Cache.Snapshot.nChangedFields = (1 << FIELD_COUNT) - 1;
+    Cache.Snapshot.nTimestampMs = nNowMs - nAgeMs;  // keep the real age on our clock
+    Cache.Snapshot.nSeq = 1;
+    {
+        const std::lock_guard<std::mutex> lock(m_PublishMutex);
+        m_Snapshot.store(Cache.Snapshot);
+        m_nLastGoodDataMs = Cache.Snapshot.nTimestampMs;
+        m_nSampleSeq = Cache.Snapshot.nSeq;
+    }
+    m_nLatencyMs = Cache.nLatencyMs;
+    m_bWarmStartValid = true;
+
+#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
+    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [loadWarmStartCache] loaded " << sPath << ", data age " << nAgeMs << " ms" << std::endl;
+    m_sLogFile.flush();
+#endif
+    return true;
+}
+
+size_t CWeatherEagle::writeFunction(void* ptr, size_t size, size_t nmemb, void* data)
+{
+    ((std::string*)data)->append((char*)ptr, size * nmemb);
+    return size * nmemb;
+}
+
+std::string CWeatherEagle::cleanupResponse(const std::string InString, char cSeparator)
+{
+    std::string sSegment;
+    std::vector<std::string> svFields;
+
+    if(!InString.size()) {
+#ifdef PLUGIN_DEBUG
+        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [cleanupResponse] InString is empty." << std::endl;
+        m_sLogFile.flush();
+#endif
+        return InString;
+    }
+
+
+    std::stringstream ssTmp(InString);
+
+    svFields.clear();
+    // split the string into vector elements
+    while(std::getline(ssTmp, sSegment, cSeparator))
+    {
+        if(sSegment.find("<!-") == -1)
+            svFields.push_back(sSegment);
+    }
+
+    if(svFields.size()==0) {
+        return std::string("");
+    }
+
+    sSegment.clear();
+    for( std::string s : svFields)
+        sSegment.append(trim(s,"\n\r "));
+    return sSegment;
+}
+
+
+#pragma mark - Getter / Setter
+void CWeatherEagle::getSnapshot(WeatherEagleSnapshot &Snapshot)
+{
+    Snapshot = m_Snapshot.load();
+}
+
+// derive stage, stamp and store the sample, and return the sinks it goes to
+void CWeatherEagle::storeSnapshot(WeatherEagleSnapshot &Snapshot, std::vector<std::shared_ptr<CSnapshotSink>> &vSinks)
+{
+    const std::lock_guard<std::mutex> lock(m_PublishMutex);
+
+    Snapshot.nSeq = m_nSampleSeq + 1;
+    Snapshot.nTimestampMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    Snapshot.nWallTimeMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    strncpy(Snapshot.szFirmware, m_sPublishedFirmware.c_str(), sizeof(Snapshot.szFirmware)-1);
+    Snapshot.szFirmware[sizeof(Snapshot.szFirmware)-1] = 0;
+    strncpy(Snapshot.szModel, m_sPublishedModel.c_str(), sizeof(Snapshot.szModel)-1);
+    Snapshot.szModel[sizeof(Snapshot.szModel)-1] = 0;
+    Snapshot.nChangedFields = detectChanges(Snapshot, Snapshot.nTimestampMs);
+    if(Snapshot.nChangedFields == 0)
+        m_nUnchangedSamples++;
+    m_nSamples++;
+
+    m_Snapshot.store(Snapshot);
+    m_nLastGoodDataMs = Snapshot.nTimestampMs;
+    m_nSampleSeq = Snapshot.nSeq;
+    if(m_nFirstSampleMs < 0)
+        m_nFirstSampleMs = int(Snapshot.nTimestampMs - m_nConnectStartMs);
+
+    vSinks = m_vSinks;
+}
+
+// No readings until the next sample, nothing left to serve or save for the warm start.
+// The sequence numbers keep going up so readers see the next sample as new.
+void CWeatherEagle::clearSnapshot()
+{
+    const std::lock_guard<std::mutex> lock(m_PublishMutex);
+    WeatherEagleSnapshot Snapshot;
+
+    memset(&Snapshot, 0, sizeof(Snapshot));
+    Snapshot.dExtTemp[0] = Snapshot.dExtTemp[1] = Snapshot.dExtTemp[2] = -273.15;
+    m_Snapshot.store(Snapshot);
+    m_nLastGoodDataMs = -1;
+    m_nDeadbandRefValid = 0;
+    m_bWarmStartValid = false;
+}
+
+// Compare the sample with the last reported values, under m_PublishMutex.
+// With nothing out of its deadband for DEADBAND_HEARTBEAT_MS every field is reported again.
+uint32_t CWeatherEagle::detectChanges(WeatherEagleSnapshot &Snapshot, int64_t nNowMs)
+{
+    uint32_t nChanged = 0;
+    uint32_t nFields = m_nPollFields;
+    uint32_t nBit;
+    double dValue;
+    double dDelta;
+
+    for(int nField = 0; nField < FIELD_COUNT; nField++) {
+        nBit = 1 << nField;
+        if(!(nFields & nBit))
+            continue;
+        dValue = *(double *)((char *)&Snapshot + EccoFields[nField].nOffset);
+        if(m_nDeadbandRefValid & nBit) {
+            dDelta = fabs(dValue - m_dDeadbandRef[nField]);
+            if(dDelta <= EccoFields[nField].dAbsDeadband || dDelta <= EccoFields[nField].dRelDeadband * fabs(m_dDeadbandRef[nField]))
+                continue;
+        }
+        m_dDeadbandRef[nField] = dValue;
+        m_nDeadbandRefValid |= nBit;
+        nChanged |= nBit;
+    }
+
+    if(!nChanged && nNowMs - m_nLastChangeMs >= DEADBAND_HEARTBEAT_MS) {
+        for(int nField = 0; nField < FIELD_COUNT; nField++) {
+            if(!(nFields & (1 << nField)))
+                continue;
+            m_dDeadbandRef[nField] = *(double *)((char *)&Snapshot + EccoFields[nField].nOffset);
+            nChanged |= 1 << nField;
+        }
+        Snapshot.nFlags |= SNAPSHOT_FLAG_HEARTBEAT;
+    }
+    if(nChanged)
+        m_nLastChangeMs = nNowMs;
+    return nChanged;
+}
+
+// Synchronous path used by Connect, before the device is handed to the poller
+void CWeatherEagle::publishSnapshot(WeatherEagleSnapshot &Snapshot)
+{
+    std::vector<std::shared_ptr<CSnapshotSink>> vSinks;
+
+    storeSnapshot(Snapshot, vSinks);
+    for(auto &pSink : vSinks)
+        pSink->publish(Snapshot);
+}
+
+void CWeatherEagle::startSinks()
+{
+    std::vector<std::shared_ptr<CSnapshotSink>> vSinks;
+    WeatherEagleSnapshot Snapshot;
+
+    if(m_Export.bSharedMemory)
+        vSinks.push_back(std::make_shared<CSharedMemorySink>());
+    if(m_Export.nHttpPort > 0 || m_Export.bAlpaca)
+        vSinks.push_back(std::make_shared<CEagleHttpServer>(m_Export.sHttpBindAddress,
+                                                            m_Export.nHttpPort > 0 ? m_Export.nHttpPort : ALPACA_DEFAULT_PORT,
+                                                            m_Export.bAlpaca));
+    if(!m_Export.sBoltwoodFile.empty())
+        vSinks.push_back(std::make_shared<CBoltwoodFileSink>(m_Export.sBoltwoodFile, m_Export.nBoltwoodIntervalMs));
+    if(!m_Export.sMqttHost.empty())
+        vSinks.push_back(std::make_shared<CMqttSink>(m_Export.sMqttHost, m_Export.nMqttPort, m_Export.sMqttTopicPrefix,
+                                                     m_Export.sMqttUser, m_Export.sMqttPassword));
+
+    for(auto &pSink : vSinks) {
+        pSink->setWorker(CEaglePipeline::instance().nextSinkWorker());
+        if(!pSink->start(this)) {
+#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
+            m_sLogFile << "["<<getTimeStamp()<<"]"<< " [startSinks] sink failed to start" << std::endl;
+            m_sLogFile.flush();
+#endif
+            continue;
+        }
+        // under the publish lock so the sink can't miss a sample between the two
+        const std::lock_guard<std::mutex> lock(m_PublishMutex);
+        Snapshot = m_Snapshot.load();
+        if(Snapshot.nSeq)
+            pSink->publish(Snapshot);
+        m_vSinks.push_back(pSink);
+    }
+}
+
+void CWeatherEagle::stopSinks()
+{
+    std::vector<std::shared_ptr<CSnapshotSink>> vSinks;
+
+    {
+        const std::lock_guard<std::mutex> lock(m_PublishMutex);
+        vSinks.swap(m_vSinks);
+    }
+    for(auto &pSink : vSinks)
+        pSink->stop();
+}
+
+double CWeatherEagle::getAmbianTemp()
+{
+    return m_Snapshot.load().dTemp;
+}
+
+double CWeatherEagle::getHumidity()
+{
+    return m_Snapshot.load().dPercentHumdity;
+}
+
+double CWeatherEagle::getDewPointTemp()
+{
+    return m_Snapshot.load().dDewPointTemp;
+}
+
+double CWeatherEagle::getBarometricPressure()
+{
+    return m_Snapshot.load().dBarometricPressure;
+}
+
+double CWeatherEagle::getExteSensorTemp(int nIndex)
+{
+    // <rca_portidx>=5,6,7;
+    if(nIndex<5 || nIndex>7)
+        return -273.15;
+
+    return m_Snapshot.load().dExtTemp[nIndex-5];
+}
+
+int CWeatherEagle::getData()
+{
+    int nErr = PLUGIN_OK;
+    std::string response_string;
+
+    if(!m_bIsConnected || !m_Curl)
+        return ERR_COMMNOLINK;
+
+#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
+    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [getData] Called." << std::endl;
+    m_sLogFile.flush();
+#endif
+    // do http GET request to local server environmental data
+    nErr = doGET("/getecco", response_string);
+    if(nErr) {
+        return nErr;
+    }
+
+    return processEccoResponse(response_string);
+}
+
+int CWeatherEagle::processEccoResponse(const std::string &sResp)
+{
+    WeatherEagleSnapshot Snapshot;
+    int nErr;
+
+    nErr = parseEccoResponse(sResp, Snapshot);
+    if(nErr == NOT_CONNECTED)
+        return PLUGIN_OK;
+    if(nErr)
+        return nErr;
+    publishSnapshot(Snapshot);
+    return PLUGIN_OK;
+}
+
+// parse stage, also runs on the pipeline thread
+int CWeatherEagle::parseEccoResponse(const std::string &sResp, WeatherEagleSnapshot &Snapshot)
+{
+    json jResp;
+    uint32_t nFields = m_nPollFields;
+    uint32_t nFound;
+    std::string sBaseUrl;
+
+    memset(&Snapshot, 0, sizeof(Snapshot));
+    Snapshot.dExtTemp[0] = Snapshot.dExtTemp[1] = Snapshot.dExtTemp[2] = -273.15;
+    // process response_string
+    try {
+        jResp = json::parse(sResp);
+        if(jResp.at("result").get<std::string>() == "OK") {
+            if(jResp.at("ecco").get<std::string>() == "Connected") {
+                // a sensor went away (unplugged ext port, firmware update), probe the fields again
+                nFound = detectEccoFields(jResp);
+                if((nFields & nFound) != nFields) {
+#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
+                    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [parseEccoResponse] fields 0x" << std::hex << nFields << " now 0x" << nFound << std::dec << std::endl;
+                    m_sLogFile.flush();
+#endif
+                    nFields = nFound;
+                    setPollFields(nFields);
+                    getBaseUrl(sBaseUrl);
+                    CWeatherEagleRegistry::dropCapabilities(sBaseUrl);
+                    if(!nFields)
+                        return ERR_CMDFAILED;
+                }
+                // only the fields this device reported during the capability probe
+                for(int nField = 0; nField < FIELD_COUNT; nField++) {
+                    if(nFields & (1 << nField))
+                        *(double *)((char *)&Snapshot + EccoFields[nField].nOffset) = jResp.at(EccoFields[nField].pszKey).get<double>();
+                }
+            }
+            else
+                return NOT_CONNECTED;   // ECCO not connected, nothing to publish
+        }
+        else {
+#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
+            m_sLogFile << "["<<getTimeStamp()<<"]"<< " [parseEccoResponse] getecco error : " << jResp << std::endl;
+            m_sLogFile.flush();
+#endif
+            return ERR_CMDFAILED;
+        }
+    }
+    catch (json::exception& e) {
+#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
+        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [parseEccoResponse] json exception : " << e.what() << " - " << e.id << std::endl;
+        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [parseEccoResponse] json exception response : " << sResp << std::endl;
+        m_sLogFile.flush();
+#endif
+        return ERR_CMDFAILED;
+    }
+
+
+#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
+    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [parseEccoResponse] dTemp                : " << Snapshot.dTemp << std::endl;
+    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [parseEccoResponse] dPercentHumdity      : " << Snapshot.dPercentHumdity << std::endl;
+    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [parseEccoResponse] dBarometricPressure  : " << Snapshot.dBarometricPressure << std::endl;
+    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [parseEccoResponse] dDewPointTemp        : " << Snapshot.dDewPointTemp << std::endl;
+    m_sLogFile.flush();
+#endif
+
+    return PLUGIN_OK;
+}
+
+
+#pragma mark - Getter / Setter
+
+
+std::shared_ptr<const WeatherEagleConfig> CWeatherEagle::getConfig()
+{
+    return std::atomic_load(&m_pConfig);
+}
+
+void CWeatherEagle::getConfig(WeatherEagleConfig &Config)
+{
+    Config = *getConfig();
+}
+
+// Publish a new settings object, requests already running keep the one they started with.
+// Callers changing the endpoint of a connected device go through CWeatherEagleRegistry::reconfigure.
+void CWeatherEagle::setConfig(const WeatherEagleConfig &Config)
+{
+    std::shared_ptr<WeatherEagleConfig> pConfig = std::make_shared<WeatherEagleConfig>(Config);
+
+    pConfig->nPollIntervalMs = std::max(pConfig->nPollIntervalMs, MIN_POLL_INTERVAL_MS);
+    pConfig->nConnectTimeoutMs = std::max(pConfig->nConnectTimeoutMs, 1);
+    pConfig->nTransferTimeoutMs = std::max(pConfig->nTransferTimeoutMs, 0);
+    while(!pConfig->sHedgeUrl.empty() && pConfig->sHedgeUrl.back() == '/')
+        pConfig->sHedgeUrl.pop_back();
+    pConfig->sBaseUrl = makeBaseUrl(pConfig->sIpAddress, pConfig->nTcpPort, pConfig->Tls.bHttps);
+    std::atomic_store(&m_pConfig, std::shared_ptr<const WeatherEagleConfig>(pConfig));
+#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
+    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [setConfig] New base url : " << pConfig->sBaseUrl << " verify peer : " << (pConfig->Tls.bVerifyPeer?"Yes":"No") << " pinned : " << (pConfig->Tls.sPinnedPublicKey.empty()?"No":"Yes") << std::endl;
+    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [setConfig] poll interval : " << pConfig->nPollIntervalMs << " connect timeout : " << pConfig->nConnectTimeoutMs << " transfer timeout : " << pConfig->nTransferTimeoutMs << std::endl;
+    m_sLogFile.flush();
+#endif
+}
+
+void CWeatherEagle::initConfig(WeatherEagleConfig &Config)
+{
+    Config.sIpAddress.clear();
+    Config.nTcpPort = 0;
+    Config.Tls.bHttps = false;
+    Config.Tls.bVerifyPeer = false;
+    Config.Tls.sPinnedPublicKey.clear();
+    Config.nPollIntervalMs = POLL_INTERVAL_MS;
+    Config.nConnectTimeoutMs = DEFAULT_CONNECT_TIMEOUT_MS;
+    Config.nTransferTimeoutMs = DEFAULT_TRANSFER_TIMEOUT_MS;
+    Config.bHedging = false;
+    Config.sHedgeUrl.clear();
+    Config.sBaseUrl.clear();
+}
+
+int CWeatherEagle::getPollIntervalMs()
+{
+    return getConfig()->nPollIntervalMs;
+}
+
+void CWeatherEagle::getIpAddress(std::string &IpAddress)
+{
+    IpAddress = getConfig()->sIpAddress;
+}
+
+void CWeatherEagle::setIpAddress(std::string IpAddress)
+{
+    WeatherEagleConfig Config;
+
+    getConfig(Config);
+    Config.sIpAddress = IpAddress;
+    setConfig(Config);
+}
+
+void CWeatherEagle::getTcpPort(int &nTcpPort)
+{
+    nTcpPort = getConfig()->nTcpPort;
+}
+
+void CWeatherEagle::setTcpPort(int nTcpPort)
+{
+    WeatherEagleConfig Config;
+
+    getConfig(Config);
+    Config.nTcpPort = nTcpPort;
+    setConfig(Config);
+}
+
+void CWeatherEagle::getTlsSettings(WeatherEagleTlsSettings &Tls)
+{
+    Tls = getConfig()->Tls;
+}
+
+void CWeatherEagle::setTlsSettings(const WeatherEagleTlsSettings &Tls)
+{
+    WeatherEagleConfig Config;
+
+    getConfig(Config);
+    Config.Tls = Tls;
+    setConfig(Config);
+}
+
+void CWeatherEagle::getExportSettings(WeatherEagleExportSettings &Export)
+{
+    Export = m_Export;
+}
+
+void CWeatherEagle::setExportSettings(const WeatherEagleExportSettings &Export)
+{
+    m_Export = Export;
+}
+
+void CWeatherEagle::getBaseUrl(std::string &sBaseUrl)
+{
+    sBaseUrl = getConfig()->sBaseUrl;
+}
+
+std::string CWeatherEagle::getDeviceTag()
+{
+    std::string sTag;
+    std::shared_ptr<const WeatherEagleConfig> pConfig = getConfig();
+
+    sTag = pConfig->sIpAddress + "_" + std::to_string(pConfig->nTcpPort);
+    for(char &c : sTag) {
+        if(!isalnum((unsigned char)c) && c != '.' && c != '-')
+            c = '_';
+    }
+    return sTag;
+}
+
+// the scheme only depends on the settings, not on which setter was called last
+std::string CWeatherEagle::makeBaseUrl(const std::string &sIpAddress, int nTcpPort, bool bHttps)
+{
+    if(bHttps || nTcpPort==443) {
+        if(nTcpPort==443)
+            return "https://"+sIpAddress;
+        return "https://"+sIpAddress+":"+std::to_string(nTcpPort);
+    }
+    if(nTcpPort==80)
+        return "http://"+sIpAddress;
+    return "http://"+sIpAddress+":"+std::to_string(nTcpPort);
+}
+
+std::string& CWeatherEagle::trim(std::string &str, const std::string& filter )
+{
+    return ltrim(rtrim(str, filter), filter);
+}
+
+std::string& CWeatherEagle::ltrim(std::string& str, const std::string& filter)
+{
+    str.erase(0, str.find_first_not_of(filter));
+    return str;
+}
+
+std::string& CWeatherEagle::rtrim(std::string& str, const std::string& filter)
+{
+    str.erase(str.find_last_not_of(filter) + 1);
+    return str;
+}
+
+std::string CWeatherEagle::findField(std::vector<std::string> &svFields, const std::string& token)
+{
+    for(int i=0; i<svFields.size(); i++){
+        if(svFields[i].find(token)!= -1) {
+            return svFields[i];
+        }
+    }
+    return std::string();
+}
+
+
+#pragma mark - device registry
+
+std::mutex CWeatherEagleRegistry::m_RegistryMutex;
+std::map<std::string, CWeatherEagleRegistry::RegistryEntry> CWeatherEagleRegistry::m_Devices;
+std::map<std::string, WeatherEagleCapabilities> CWeatherEagleRegistry::m_Capabilities;
+
+std::shared_ptr<CWeatherEagle> CWeatherEagleRegistry::acquire(const WeatherEagleConfig &Config, const WeatherEagleExportSettings &Export, int &nErr)
+{
+    std::shared_ptr<CWeatherEagle> pWeatherEagle;
+    std::string sBaseUrl = CWeatherEagle::makeBaseUrl(Config.sIpAddress, Config.nTcpPort, Config.Tls.bHttps);
+
+    nErr = PLUGIN_OK;
+    {
+        const std::lock_guard<std::mutex> lock(m_RegistryMutex);
+        RegistryEntry &Entry = m_Devices[sBaseUrl];
+        if(!Entry.pWeatherEagle) {
+            Entry.pWeatherEagle = std::make_shared<CWeatherEagle>();
+            Entry.pWeatherEagle->setConfig(Config);
+            Entry.pWeatherEagle->setExportSettings(Export);
+            // serve last session's readings while the link comes up
+            Entry.pWeatherEagle->loadWarmStartCache();
+            Entry.nRefCount = 0;
+        }
+        Entry.nRefCount++;
+        pWeatherEagle = Entry.pWeatherEagle;
+    }
+
+    // connect outside of the registry lock so other devices are not held up
+    {
+        const std::lock_guard<std::mutex> lock(pWeatherEagle->m_LinkMutex);
+        if(!pWeatherEagle->IsConnected())
+            nErr = pWeatherEagle->Connect();
+    }
+
+    if(nErr) {
+        release(pWeatherEagle);
+        return nullptr;
+    }
+    return pWeatherEagle;
+}
+
+// Apply new settings to a device in use. Cadence, deadlines and TLS options take effect on the next request.
+// A new endpoint moves the device to its new registry key and redoes the handshake in the background,
+// unless the device is shared with other instances or the new endpoint is already open,
+// then this instance switches to a device of its own (or the existing one) and may block in Connect.
+int CWeatherEagleRegistry::reconfigure(std::shared_ptr<CWeatherEagle> &pWeatherEagle, const WeatherEagleConfig &Config)
+{
+    int nErr = PLUGIN_OK;
+    bool bMoved = false;
+    std::string sOldUrl;
+    std::string sNewUrl = CWeatherEagle::makeBaseUrl(Config.sIpAddress, Config.nTcpPort, Config.Tls.bHttps);
+    WeatherEagleExportSettings Export;
+    std::shared_ptr<CWeatherEagle> pOld;
+
+    if(!pWeatherEagle)
+        return ERR_COMMNOLINK;
+
+    {
+        const std::lock_guard<std::mutex> link(pWeatherEagle->m_LinkMutex);
+
+        pWeatherEagle->getBaseUrl(sOldUrl);
+        if(sNewUrl == sOldUrl) {
+            pWeatherEagle->setConfig(Config);
+            return PLUGIN_OK;
+        }
+
+        {
+            const std::lock_guard<std::mutex> lock(m_RegistryMutex);
+            auto it = m_Devices.find(sOldUrl);
+            if(it != m_Devices.end() && it->second.pWeatherEagle == pWeatherEagle && it->second.nRefCount == 1 && !m_Devices.count(sNewUrl)) {
+                m_Devices[sNewUrl] = it->second;
+                m_Devices.erase(it);
+                // the url changes under the same lock so release always finds the device
+                pWeatherEagle->setConfig(Config);
+                bMoved = true;
+            }
+        }
+
+        if(bMoved) {
+#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
+            pWeatherEagle->m_sLogFile << "["<<pWeatherEagle->getTimeStamp()<<"]"<< " [reconfigure] " << sOldUrl << " -> " << sNewUrl << std::endl;
+            pWeatherEagle->m_sLogFile.flush();
+#endif
+            if(pWeatherEagle->IsConnected())
+                pWeatherEagle->relink();
+            return PLUGIN_OK;
+        }
+    }
+
+    // shared device or new endpoint already open, swap devices the slow way
+    pWeatherEagle->getExportSettings(Export);
+    pOld = pWeatherEagle;
+    pWeatherEagle = acquire(Config, Export, nErr);
+    if(!pWeatherEagle) {
+        pWeatherEagle = pOld;
+        return nErr;
+    }
+    release(pOld);
+    return PLUGIN_OK;
+}
+
+void CWeatherEagleRegistry::release(std::shared_ptr<CWeatherEagle> &pWeatherEagle)
+{
+    bool bLastUser = false;
+    std::string sBaseUrl;
+
+    if(!pWeatherEagle)
+        return;
+
+    pWeatherEagle->getBaseUrl(sBaseUrl);
+    {
+        const std::lock_guard<std::mutex> lock(m_RegistryMutex);
+        auto it = m_Devices.find(sBaseUrl);
+        if(it != m_Devices.end() && it->second.pWeatherEagle == pWeatherEagle) {
+            if(--it->second.nRefCount <= 0) {
+                m_Devices.erase(it);
+                bLastUser = true;
+            }
+        }
+    }
+
+    // last instance using this device, stop the poller and close the connection
+    if(bLastUser) {
+        const std::lock_guard<std::mutex> lock(pWeatherEagle->m_LinkMutex);
+        pWeatherEagle->Disconnect();
+    }
+    pWeatherEagle.reset();
+}
+
+bool CWeatherEagleRegistry::getCapabilities(const std::string &sBaseUrl, WeatherEagleCapabilities &Caps)
+{
+    const std::lock_guard<std::mutex> lock(m_RegistryMutex);
+    auto it = m_Capabilities.find(sBaseUrl);
+    if(it == m_Capabilities.end())
+        return false;
+    Caps = it->second;
+    return true;
+}
+
+void CWeatherEagleRegistry::setCapabilities(const std::string &sBaseUrl, const WeatherEagleCapabilities &Caps)
+{
+    const std::lock_guard<std::mutex> lock(m_RegistryMutex);
+    m_Capabilities[sBaseUrl] = Caps;
+}
+
+void CWeatherEagleRegistry::dropCapabilities(const std::string &sBaseUrl)
+{
+    const std::lock_guard<std::mutex> lock(m_RegistryMutex);
+    m_Capabilities.erase(sBaseUrl);
+}
+
+int CWeatherEagleRegistry::getRefCount(const std::string &sBaseUrl)
+{
+    const std::lock_guard<std::mutex> lock(m_RegistryMutex);
+    auto it = m_Devices.find(sBaseUrl);
+    if(it == m_Devices.end())
+        return 0;
+    return it->second.nRefCount;
+}
+
+#pragma mark - libcurl runtime
+
+std::mutex  CCurlRuntime::m_RuntimeMutex;
+int         CCurlRuntime::m_nRefCount = 0;
+CURLSH      *CCurlRuntime::m_Share = nullptr;
+std::mutex  CCurlRuntime::m_ShareLocks[CURL_LOCK_DATA_LAST];
+
+bool CCurlRuntime::acquire()
+{
+    const std::lock_guard<std::mutex> lock(m_RuntimeMutex);
+
+    if(m_nRefCount == 0) {
+        // CURL_GLOBAL_SSL is a no-op since libcurl 7.57, TLS backends initialize on first use
+        if(curl_global_init(CURL_GLOBAL_DEFAULT) != CURLE_OK)
+            return false;
+        m_Share = curl_share_init();
+        if(m_Share) {
+            curl_share_setopt(m_Share, CURLSHOPT_LOCKFUNC, lockShare);
+            curl_share_setopt(m_Share, CURLSHOPT_UNLOCKFUNC, unlockShare);
+            // no CURL_LOCK_DATA_CONNECT, the handles run on several threads at once and libcurl
+            // doesn't support a shared connection cache used that way
+            curl_share_setopt(m_Share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+            curl_share_setopt(m_Share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+        }
+    }
+    m_nRefCount++;
+    return true;
+}
+
+void CCurlRuntime::release()
+{
+    const std::lock_guard<std::mutex> lock(m_RuntimeMutex);
+
+    if(m_nRefCount == 0)
+        return;
+    // the last user has cleaned up its easy handles, nothing references the share anymore
+    if(--m_nRefCount == 0) {
+        if(m_Share)
+            curl_share_cleanup(m_Share);
+        m_Share = nullptr;
+        curl_global_cleanup();
+    }
+}
+
+CURLSH* CCurlRuntime::share()
+{
+    return m_Share;
+}
+
+void CCurlRuntime::lockShare(CURL *, curl_lock_data data, curl_lock_access, void *)
+{
+    m_ShareLocks[data < CURL_LOCK_DATA_LAST ? data : 0].lock();
+}
+
+void CCurlRuntime::unlockShare(CURL *, curl_lock_data data, void *)
+{
+    m_ShareLocks[data < CURL_LOCK_DATA_LAST ? data : 0].unlock();
+}
 
 #ifdef PLUGIN_DEBUG
 void CWeatherEagle::log(const std::string sLogLine)
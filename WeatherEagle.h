@@ -31,6 +31,7 @@
 #include <string.h>
 #include <string>
 #include <vector>
+#include <algorithm>
 #include <sstream>
 #include <iostream>
 #include <iomanip>
@@ -41,6 +42,11 @@
 #include <cmath>
 #include <future>
 #include <mutex>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <atomic>
+#include <random>
 
 
 #include "../../licensedinterfaces/sberrorx.h"
@@ -57,13 +63,249 @@ using json = nlohmann::json;
 #define MAX_READ_WAIT_TIMEOUT 25
 #define NB_RX_WAIT 10
 
-#define MAX_CONNECT_TIMEOUT 5
+#define ECCO_CONNECT_TIMEOUT_MS     3000    // wait for the ECCO to report Connected after /connectecco
+#define ECCO_BACKOFF_MIN_MS         25      // /getecco retry backoff during that wait
+#define ECCO_BACKOFF_MAX_MS         250
+
+#define POLL_INTERVAL_MS 5000
+#define MIN_POLL_INTERVAL_MS        500
+#define DEFAULT_CONNECT_TIMEOUT_MS  3000
+#define DEFAULT_TRANSFER_TIMEOUT_MS 0       // whole request deadline, 0 = none
+
+#define DEFAULT_STALE_THRESHOLD_MS  7500    // data older than this triggers an on demand refresh
+#define DEFAULT_REFRESH_WAIT_MS     0       // how long a reader may wait for that refresh
+#define MAX_REFRESH_WAIT_MS         1000
+
+#define BOLTWOOD_DEFAULT_INTERVAL_MS    5000    // one-line weather file rewrite rate
+
+// warm start cache, last readings and device info kept across sessions
+#define WARM_START_MAGIC            0x45474C45  // "EGLE"
+#define WARM_START_VERSION          1
+#define WARM_START_MAX_AGE_MS       3600000     // older readings are not worth serving
+#define WARM_START_RETRY_MIN_MS     250         // background handshake retry backoff
+#define WARM_START_RETRY_MAX_MS     30000
+
+// device capabilities, probed once per device and cached process wide
+#define CAPABILITY_TTL_MS           86400000    // re-probe a device once a day
+
+#define CAP_ENDPOINT_GETINFO        0x0001
+#define CAP_ENDPOINT_GETECCO        0x0002
+
+enum WeatherEagleFields {FIELD_TEMP=0, FIELD_HUMIDITY, FIELD_DEWPOINT, FIELD_PRESSURE, FIELD_TEMP5, FIELD_TEMP6, FIELD_TEMP7, FIELD_COUNT};
+
+// snapshot flags
+#define SNAPSHOT_FLAG_WARM_START    0x0001      // restored from the cache file, not live data
+#define SNAPSHOT_FLAG_HEARTBEAT     0x0002      // nothing moved for DEADBAND_HEARTBEAT_MS, all fields flagged changed
+
+// change detection, see EccoFields for the per field deadbands
+#define DEADBAND_HEARTBEAT_MS       60000       // max silence before all the fields are reported again
+
+// phase locked polling, requests are aligned just after the device own sensor refresh
+#define PHASE_LEARN_SPEEDUP         4       // learning polls at interval / this, at most 4x the nominal load
+#define PHASE_LEARN_MIN_POLL_MS     500     // and never faster than this
+#define PHASE_LEARN_MAX_MS          90000   // give up learning after this long, poll at the nominal interval
+#define PHASE_RELEARN_MS            3600000 // and try again after this long
+#define PHASE_LOCK_SAMPLES          3       // period estimates needed before locking on
+#define PHASE_MIN_PERIOD_MS         1000    // faster devices are simply polled at the nominal interval
+#define PHASE_GUARD_MS              100     // poll this long after the predicted refresh
+#define PHASE_CREEP_MS              50      // locked polls move earlier by this much until they come too early
+#define PHASE_RETRY_MS              250     // a locked poll that came too early is retried after this
+#define PHASE_MAX_RETRIES           4
+#define PHASE_MAX_MISSES            3       // consecutive refreshes not found before unlocking
+#define PHASE_MIN_GAP_MS            250
+#define DUPLICATE_MAX_AGE_MS        5000    // identical responses are still published past this age, below DEFAULT_STALE_THRESHOLD_MS
+
+// hedged polls, a second request is sent when the first one runs past the usual latency
+#define HEDGE_LATENCY_SAMPLES       64      // recent poll latencies kept for the percentile
+#define HEDGE_MIN_SAMPLES           16      // don't hedge before the latency is known
+#define HEDGE_PERCENTILE            95
+#define HEDGE_MIN_DELAY_MS          20
+#define HEDGE_BUDGET_PERCENT        10      // process wide, hedges per 100 polls
+#define HEDGE_BUDGET_BURST          5       // hedges that can be spent at once
+
+// circuit breaker around the http transport
+#define BREAKER_FAILURE_THRESHOLD   3       // consecutive transport failures before tripping
+#define BREAKER_BASE_BACKOFF_MS     5000    // first open period
+#define BREAKER_MAX_BACKOFF_MS      300000  // backoff cap (5 minutes)
+#define BREAKER_JITTER_PERCENT      20      // +/- jitter applied to each open period
+#define BREAKER_PROBE_TIMEOUT_MS    1000    // connect timeout used by the half-open probe
+
+// keep the (TLS) connection to the Eagle open between polls
+#define TCP_KEEPALIVE_IDLE_S        30
+#define TCP_KEEPALIVE_INTERVAL_S    15
+#define CONNECTION_MAX_AGE_S        600     // idle connections older than this are not reused
 
 // error codes
 enum WeatherEagleErrors {PLUGIN_OK=0, NOT_CONNECTED, CANT_CONNECT, BAD_CMD_RESPONSE, COMMAND_FAILED, COMMAND_TIMEOUT, PARSE_FAILED};
 
 enum WeatherEagleWindUnits {KPH=0, MPS, MPH};
 
+enum WeatherEagleBreakerState {BREAKER_CLOSED=0, BREAKER_OPEN, BREAKER_HALF_OPEN};
+
+// One set of readings, published as a whole so readers never see a mix of two polls.
+// Must stay trivially copyable, it is stored in a CSeqLock.
+typedef struct {
+    uint64_t    nSeq;               // incremented on each publish, 0 = no data yet
+    int64_t     nTimestampMs;       // steady clock time of the sample
+    int64_t     nWallTimeMs;        // system clock time of the sample
+    uint32_t    nFlags;             // SNAPSHOT_FLAG_xxx
+    uint32_t    nChangedFields;     // (1 << FIELD_xxx) that moved past their deadband, sinks can skip the others
+    double      dTemp;
+    double      dPercentHumdity;
+    double      dDewPointTemp;
+    double      dBarometricPressure;
+    double      dExtTemp[3];        // rca ports 5, 6 and 7
+    char        szFirmware[32];
+    char        szModel[32];
+} WeatherEagleSnapshot;
+
+// Sequence lock, writers are serialized by the caller, readers never block and retry
+// if they raced with a write. The payload is kept in atomic words so the copy is race free.
+template <typename T>
+class CSeqLock
+{
+public:
+    CSeqLock()
+    {
+        T Empty;
+        memset(&Empty, 0, sizeof(T));
+        m_nSeq = 0;
+        store(Empty);
+    }
+
+    void store(const T &Value)
+    {
+        uint64_t Words[nWords] = {};
+        memcpy(Words, &Value, sizeof(T));
+
+        uint32_t nSeq = m_nSeq.load(std::memory_order_relaxed);
+        m_nSeq.store(nSeq + 1, std::memory_order_relaxed);  // odd, write in progress
+        std::atomic_thread_fence(std::memory_order_release);
+        for(size_t i = 0; i < nWords; i++)
+            m_Words[i].store(Words[i], std::memory_order_relaxed);
+        m_nSeq.store(nSeq + 2, std::memory_order_release);
+    }
+
+    T load() const
+    {
+        uint64_t Words[nWords];
+        uint32_t nSeqBefore, nSeqAfter;
+        T Value;
+
+        do {
+            nSeqBefore = m_nSeq.load(std::memory_order_acquire);
+            for(size_t i = 0; i < nWords; i++)
+                Words[i] = m_Words[i].load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            nSeqAfter = m_nSeq.load(std::memory_order_relaxed);
+        } while((nSeqBefore & 1) || nSeqBefore != nSeqAfter);
+
+        memcpy(&Value, Words, sizeof(T));
+        return Value;
+    }
+
+private:
+    static const size_t     nWords = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+    std::atomic<uint32_t>   m_nSeq;
+    std::atomic<uint64_t>   m_Words[nWords];
+};
+
+typedef struct {
+    std::string sModel;
+    std::string sFirmware;
+    double      dFirmwareVersion;
+    uint32_t    nEndpoints;         // CAP_ENDPOINT_xxx
+    uint32_t    nFields;            // (1 << FIELD_xxx) reported by /getecco
+    int64_t     nProbeTimeMs;       // steady clock
+} WeatherEagleCapabilities;
+
+typedef struct {
+    int         nBreakerState;
+    uint64_t    nBreakerTrips;
+    uint64_t    nBreakerFastFails;
+    uint64_t    nBreakerProbes;
+    int         nConsecutiveFailures;
+    int         nCurrentBackoffMs;
+    int         nLatencyMs;         // smoothed request round trip
+    int         nConstructionUs;    // time spent in the constructor
+    int         nFirstSampleMs;     // Connect to first published sample, -1 if none yet
+    uint64_t    nNewConnections;    // transfers that had to open a connection
+    uint64_t    nReusedConnections; // transfers served on a kept alive connection
+    uint64_t    nTlsHandshakes;
+    int         nTlsHandshakeUs;    // smoothed TLS handshake time
+    int         nLastTlsHandshakeUs;
+    uint64_t    nSamples;           // samples published
+    uint64_t    nUnchangedSamples;  // no field out of its deadband
+    double      dSuppressionRatio;  // nUnchangedSamples / nSamples
+    uint64_t    nDuplicateSamples;  // polls that returned the previous response, not republished
+    int         nRefreshPeriodMs;   // learned device refresh period, 0 = unknown
+    bool        bPhaseLocked;
+    uint64_t    nPolls;             // regular /getecco polls started
+    uint64_t    nHedges;            // second requests sent
+    uint64_t    nHedgeWins;         // polls answered by the second request
+    uint64_t    nHedgeDenied;       // hedges skipped, budget spent
+    double      dHedgeRate;         // nHedges / nPolls
+    int         nHedgeDelayMs;      // current hedge trigger, -1 = not hedging
+} WeatherEagleMetrics;
+
+typedef struct {
+    bool        bHttps;             // use https on any port, 443 always does
+    bool        bVerifyPeer;        // verify the certificate chain and host name
+    std::string sPinnedPublicKey;   // "sha256//<base64>" or a PEM/DER file, empty = no pinning
+} WeatherEagleTlsSettings;
+
+// Device settings that can change while connected. Published as an immutable object,
+// readers take a reference with std::atomic_load and always see a consistent set.
+typedef struct {
+    std::string             sIpAddress;
+    int                     nTcpPort;
+    WeatherEagleTlsSettings Tls;
+    int                     nPollIntervalMs;
+    int                     nConnectTimeoutMs;
+    int                     nTransferTimeoutMs;
+    bool                    bHedging;
+    std::string             sHedgeUrl;      // secondary endpoint for the hedged polls, empty = same one on a new connection
+    std::string             sBaseUrl;       // derived by setConfig
+} WeatherEagleConfig;
+
+// where the readings are exported besides TheSkyX, see EagleSinks.h
+typedef struct {
+    bool        bSharedMemory;      // seqlock protected shared memory segment
+    int         nHttpPort;          // local json server, 0 = disabled
+    std::string sHttpBindAddress;   // empty = all interfaces
+    bool        bAlpaca;            // Alpaca ObservingConditions api on the same server
+    std::string sBoltwoodFile;      // one-line weather file, empty = disabled
+    int         nBoltwoodIntervalMs;
+    std::string sMqttHost;          // broker, empty = disabled
+    int         nMqttPort;
+    std::string sMqttTopicPrefix;
+    std::string sMqttUser;
+    std::string sMqttPassword;
+} WeatherEagleExportSettings;
+
+class CSnapshotSink;
+
+// Process wide, refcounted libcurl runtime. curl_global_init/cleanup are not thread safe
+// so they are only called here, under a lock, by the first and last connected device.
+// The share handle lets every device reuse DNS results and TLS sessions, connections stay
+// in the cache of the handle (or multi handle) that opened them.
+class CCurlRuntime
+{
+public:
+    static bool     acquire();
+    static void     release();
+    static CURLSH*  share();
+
+private:
+    static void     lockShare(CURL *handle, curl_lock_data data, curl_lock_access access, void *userptr);
+    static void     unlockShare(CURL *handle, curl_lock_data data, void *userptr);
+
+    static std::mutex   m_RuntimeMutex;
+    static int          m_nRefCount;
+    static CURLSH       *m_Share;
+    static std::mutex   m_ShareLocks[CURL_LOCK_DATA_LAST];
+};
+
 class CWeatherEagle
 {
 public:
@@ -81,25 +323,67 @@ public:
     std::mutex  m_DevAccessMutex;
     int         getData();
 
+    // called from the shared poller thread
+    CURL*       beginPoll();
+    CURL*       beginHedge();
+    void        endPoll(CURLcode res, CURL *pEasy);
+    int         getHedgeDelayMs();
+    void        hedgeDenied() { m_nHedgeDenied++; }
+    int         nextPollDelayMs();
+    int         getPollIntervalMs();
+
+    // age of the last good sample in ms, -1 if there is none yet
+    int         getDataAge();
+    bool        refreshIfStale(int nStaleThresholdMs, int nMaxWaitMs);
+    void        cancelRefreshWaits();
+
     static size_t writeFunction(void* ptr, size_t size, size_t nmemb, void* data);
 
+    // lock free, the new settings are used from the next request on
+    std::shared_ptr<const WeatherEagleConfig> getConfig();
+    void getConfig(WeatherEagleConfig &Config);
+    void setConfig(const WeatherEagleConfig &Config);
+    static void initConfig(WeatherEagleConfig &Config);
+
     void getIpAddress(std::string &IpAddress);
     void setIpAddress(std::string IpAddress);
 
     void getTcpPort(int &nTcpPort);
     void setTcpPort(int nTcpPort);
 
+    void getTlsSettings(WeatherEagleTlsSettings &Tls);
+    void setTlsSettings(const WeatherEagleTlsSettings &Tls);
+
+    void getExportSettings(WeatherEagleExportSettings &Export);
+    void setExportSettings(const WeatherEagleExportSettings &Export);
+
+    void getBaseUrl(std::string &sBaseUrl);
+    std::string getDeviceTag();     // host_port, safe to use in file and object names
+    static std::string makeBaseUrl(const std::string &sIpAddress, int nTcpPort, bool bHttps);
+
+    // lock free, can be called from any thread
+    void   getSnapshot(WeatherEagleSnapshot &Snapshot);
+
     double getAmbianTemp();
     double getHumidity();
     double getDewPointTemp();
     double getBarometricPressure();
     double getExteSensorTemp(int nIndex);
 
+    int  getBreakerState() { return m_nBreakerState; }
+    void getCapabilities(WeatherEagleCapabilities &Caps);
+    bool loadWarmStartCache();
+    bool saveWarmStartCache();
+    void getMetrics(WeatherEagleMetrics &Metrics);
+
 #ifdef PLUGIN_DEBUG
     void  log(const std::string sLogLine);
 #endif
 
 protected:
+    friend class CWeatherEagleRegistry;
+    friend class CEaglePipeline;
+    std::mutex      m_LinkMutex;    // serialize Connect from instances sharing this device
 
     bool            m_bIsConnected;
     std::string     m_sFirmware;
@@ -107,34 +391,171 @@ protected:
     double          m_dFirmwareVersion;
 
     CURL            *m_Curl;
-    std::string     m_sBaseUrl;
-
-    std::string     m_sIpAddress;
-    int             m_nTcpPort;
-
-    bool                m_ThreadsAreRunning;
-    std::promise<void> *m_exitSignal;
-    std::future<void>   m_futureObj;
-    std::thread         m_th;
-
-    // WeatherEagle variables
-    std::atomic<double> m_dTemp;
-    std::atomic<double> m_dPercentHumdity;
-    std::atomic<double> m_dDewPointTemp;
-    std::atomic<double> m_dBarometricPressure;
-    std::atomic<double> m_dExtTemp5;
-    std::atomic<double> m_dExtTemp6;
-    std::atomic<double> m_dExtTemp7;
+    bool            m_bCurlRuntime;     // holds a CCurlRuntime reference
+    void            closeHandles();
+
+    // current settings, only ever replaced as a whole with std::atomic_store
+    std::shared_ptr<const WeatherEagleConfig>   m_pConfig;
+    void            relink();
+
+    // startup timings
+    int             m_nConstructionUs;
+    int64_t         m_nConnectStartMs;
+    std::atomic<int> m_nFirstSampleMs;
+
+    // handle and buffers used by the shared poller, independent from m_Curl
+    std::atomic<bool>   m_bPollerRunning;
+    CURL            *m_PollCurl;
+    std::string     m_sPollResponse;
+    std::string     m_sPollHeader;
+    std::string     m_sLastPollResponse;    // duplicate detection
+    std::string     m_sPollBaseUrl;         // endpoint the poll state was learned on
+    int64_t         m_nPollStartMs;         // steady clock
+    int64_t         m_nLastPublishedPollMs;
+
+    // hedged polls, poller thread only except the atomics
+    CURL            *m_HedgeCurl;
+    std::string     m_sHedgeResponse;
+    std::string     m_sHedgeHeader;
+    int             m_nPollLatencyMs[HEDGE_LATENCY_SAMPLES];
+    int             m_nPollLatencyCount;
+    int             m_nPollLatencyPos;
+    std::atomic<int>        m_nHedgeDelayMs;
+    std::atomic<uint64_t>   m_nPolls;
+    std::atomic<uint64_t>   m_nHedges;
+    std::atomic<uint64_t>   m_nHedgeWins;
+    std::atomic<uint64_t>   m_nHedgeDenied;
+    void            recordPollLatency(int nMs);
+
+    // phase locked polling, poller thread only except the atomics
+    int64_t         m_nPhasePrevPollMs;     // previous completed poll, 0 = none
+    bool            m_bPhasePrevChanged;
+    int64_t         m_nPhaseEdgeMs;         // last refresh edge, estimated
+    int64_t         m_nPhaseBracketedEdgeMs;    // last edge found right after an unchanged poll
+    int64_t         m_nPhaseLearnStartMs;
+    bool            m_bPhaseGaveUp;
+    int             m_nPhaseSamples;        // period estimates so far
+    int             m_nPhaseRetries;        // early locked polls in the current cycle
+    int             m_nPhaseMisses;
+    bool            m_bPhaseRetry;
+    std::atomic<int>        m_nPhasePeriodMs;
+    std::atomic<bool>       m_bPhaseLocked;
+    std::atomic<uint64_t>   m_nDuplicateSamples;
+    void            phaseObserve(bool bChanged, int64_t nPollMs);
+    void            phaseReset();
+
+    // WeatherEagle variables, published as one snapshot
+    CSeqLock<WeatherEagleSnapshot>  m_Snapshot;
+    std::mutex                      m_PublishMutex;     // serialize the writers (pipeline and Connect)
+    std::string                     m_sPublishedModel;  // copied into each snapshot, under m_PublishMutex
+    std::string                     m_sPublishedFirmware;
+    void                            storeSnapshot(WeatherEagleSnapshot &Snapshot, std::vector<std::shared_ptr<CSnapshotSink>> &vSinks);
+    void                            publishSnapshot(WeatherEagleSnapshot &Snapshot);
+    void                            clearSnapshot();
+
+    // deadband change detection, under m_PublishMutex
+    double                          m_dDeadbandRef[FIELD_COUNT];    // last value reported as changed
+    uint32_t                        m_nDeadbandRefValid;            // (1 << FIELD_xxx)
+    int64_t                         m_nLastChangeMs;                // steady clock
+    std::atomic<uint64_t>           m_nSamples;
+    std::atomic<uint64_t>           m_nUnchangedSamples;
+    uint32_t                        detectChanges(WeatherEagleSnapshot &Snapshot, int64_t nNowMs);
+
+    // polled samples go through CEaglePipeline, this counts the ones not fully processed yet
+    std::atomic<int>                m_nPipelineInFlight;
+
+    // exporters, fed by the pipeline sink workers, or inline by publishSnapshot on Connect
+    WeatherEagleExportSettings                  m_Export;
+    std::vector<std::shared_ptr<CSnapshotSink>> m_vSinks;
+    void                            startSinks();
+    void                            stopSinks();
+
+    // sample tracking for the on demand refresh
+    std::atomic<uint64_t>   m_nSampleSeq;
+    std::atomic<int64_t>    m_nLastGoodDataMs;  // steady clock
+    std::atomic<bool>       m_bRefreshPending;
+    std::mutex              m_RefreshMutex;     // only used to wait on m_RefreshDone, never held during I/O
+    std::condition_variable m_RefreshDone;
+    uint64_t                m_nRefreshCancelGen;    // under m_RefreshMutex
+    void                    refreshCompleted();
+
+    // transfer statistics, updated by the poller and doGET
+    std::atomic<int>        m_nLatencyMs;
+    std::atomic<uint64_t>   m_nNewConnections;
+    std::atomic<uint64_t>   m_nReusedConnections;
+    std::atomic<uint64_t>   m_nTlsHandshakes;
+    std::atomic<int>        m_nTlsHandshakeUs;
+    std::atomic<int>        m_nLastTlsHandshakeUs;
+    void                    recordTransferStats(CURL *pCurl);
+
+    // warm start
+    bool                    m_bWarmStartValid;
+    std::thread             m_WarmupThread;
+    std::string             getWarmStartCachePath();
+    void                    warmupConnect();
+    int                     linkUp();
 
     bool            m_bSafe;
 
-    int             eagleEccoConnect();
+    // circuit breaker
+    std::atomic<int>        m_nBreakerState;
+    std::atomic<int>        m_nConsecutiveFailures;
+    std::atomic<int>        m_nBackoffMs;
+    std::atomic<uint64_t>   m_nBreakerTrips;
+    std::atomic<uint64_t>   m_nBreakerFastFails;
+    std::atomic<uint64_t>   m_nBreakerProbes;
+    std::chrono::steady_clock::time_point m_tBreakerRetryAt;
+    std::mt19937            m_BreakerRng;
+    std::mutex              m_BreakerMutex;
+
+    bool            breakerAllowRequest();
+    void            breakerRecordResult(CURLcode res);
+    void            breakerRecordSuccess();
+    void            breakerRecordFailure();
+    void            breakerReset();
+
+    int             eagleEccoConnect(std::string &sEcco);
+
+    // Disconnect aborts the handshake in progress, transfers and waits return right away
+    CURLM                   *m_DoMulti;         // drives m_Curl (and m_InfoCurl) so a transfer can be woken up and dropped
+    std::atomic<bool>       m_bAbort;
+    std::mutex              m_AbortMutex;
+    std::condition_variable m_AbortCv;
+    void            abortTransfers();
+    bool            waitOrAbort(int nMs);       // false if aborted
+    CURLcode        performTransfer(CURL *pCurl);
+    CURLcode        driveTransfers(CURL *pCurl, int nMs);
+
+    // handshake /getinfo, runs on m_DoMulti while eagleEccoConnect waits for the ECCO
+    CURL            *m_InfoCurl;
+    std::string     m_sInfoResponse;
+    std::string     m_sInfoHeader;
+    bool            m_bInfoStarted;
+    bool            m_bInfoPending;     // still attached to m_DoMulti
+    CURLcode        m_InfoResult;
+    void            startInfo();
+    void            dropInfo();
+    int             collectInfo();
 
     int             doGET(std::string sCmd, std::string &sResp);
+    CURLcode        setupRequest(CURL *pCurl, const std::string &sUrl, std::string &sResponse, std::string &sHeader);
+    int             processEccoResponse(const std::string &sResp);
+    int             parseEccoResponse(const std::string &sResp, WeatherEagleSnapshot &Snapshot);
     std::string     cleanupResponse(const std::string InString, char cSeparator);
     int             getModelName();
     int             getFirmwareVersion();
 
+    // capability probe, the poll loop only reads the fields listed in m_nPollFields
+    WeatherEagleCapabilities    m_Caps;
+    json                        m_jInfo;            // last /getinfo response
+    std::atomic<uint32_t>       m_nPollFields;      // (1 << FIELD_xxx) supported by this device
+    int             getInfo();
+    int             parseInfo(const std::string &sResp);
+    bool            capabilitiesCached(WeatherEagleCapabilities &Caps);
+    int             probeCapabilities();
+    uint32_t        detectEccoFields(const json &jEcco);
+    void            setPollFields(uint32_t nFields);
+
     std::string&    trim(std::string &str, const std::string &filter );
     std::string&    ltrim(std::string &str, const std::string &filter);
     std::string&    rtrim(std::string &str, const std::string &filter);
@@ -151,4 +572,30 @@ protected:
 
 };
 
+// Process wide registry, all plugin instances pointing at the same Eagle share one
+// CWeatherEagle (one poller, one connection, one set of readings).
+class CWeatherEagleRegistry
+{
+public:
+    static std::shared_ptr<CWeatherEagle> acquire(const WeatherEagleConfig &Config, const WeatherEagleExportSettings &Export, int &nErr);
+    static void release(std::shared_ptr<CWeatherEagle> &pWeatherEagle);
+    // hot reconfiguration, moves the device to its new endpoint key
+    static int  reconfigure(std::shared_ptr<CWeatherEagle> &pWeatherEagle, const WeatherEagleConfig &Config);
+    static int  getRefCount(const std::string &sBaseUrl);
+
+    static bool getCapabilities(const std::string &sBaseUrl, WeatherEagleCapabilities &Caps);
+    static void setCapabilities(const std::string &sBaseUrl, const WeatherEagleCapabilities &Caps);
+    static void dropCapabilities(const std::string &sBaseUrl);
+
+private:
+    typedef struct {
+        std::shared_ptr<CWeatherEagle>  pWeatherEagle;
+        int                             nRefCount;
+    } RegistryEntry;
+
+    static std::mutex                               m_RegistryMutex;
+    static std::map<std::string, RegistryEntry>     m_Devices;
+    static std::map<std::string, WeatherEagleCapabilities> m_Capabilities;  // survives disconnects
+};
+
 #endif
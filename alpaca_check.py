@@ -0,0 +1,133 @@
+#!/usr/bin/env python3
+#
+#  alpaca_check.py
+#
+#  WeatherEagle X2 plugin
+#
+#  Scripted check of the Alpaca ObservingConditions api of the embedded HTTP server,
+#  run against a linked plugin with the Alpaca ini key set.
+#  usage: alpaca_check.py [host] [port]
+#
+
+import json
+import re
+import sys
+import urllib.error
+import urllib.parse
+import urllib.request
+
+HOST = sys.argv[1] if len(sys.argv) > 1 else "127.0.0.1"
+PORT = int(sys.argv[2]) if len(sys.argv) > 2 else 11111
+BASE = "http://%s:%d" % (HOST, PORT)
+
+NOT_IMPLEMENTED = 0x400
+INVALID_VALUE = 0x401
+
+nFailed = 0
+nClientTransaction = 0
+nLastServerTransaction = 0
+
+
+def check(bOk, sWhat):
+    global nFailed
+    print("%s %s" % ("ok  " if bOk else "FAIL", sWhat))
+    if not bOk:
+        nFailed += 1
+
+
+def request(sPath, dParams=None, bPut=False):
+    global nClientTransaction, nLastServerTransaction
+    nClientTransaction += 1
+    dParams = dict(dParams or {})
+    dParams["ClientID"] = 1
+    dParams["ClientTransactionID"] = nClientTransaction
+    sQuery = urllib.parse.urlencode(dParams)
+    if bPut:
+        Req = urllib.request.Request(BASE + sPath, data=sQuery.encode(), method="PUT")
+        Req.add_header("Content-Type", "application/x-www-form-urlencoded")
+    else:
+        Req = urllib.request.Request(BASE + sPath + "?" + sQuery)
+    try:
+        with urllib.request.urlopen(Req, timeout=5) as Resp:
+            nStatus = Resp.status
+            sBody = Resp.read().decode()
+    except urllib.error.HTTPError as e:
+        return e.code, None
+    jResp = json.loads(sBody)
+    # every json answer echoes the client transaction and counts the server ones
+    check(jResp.get("ClientTransactionID") == nClientTransaction, "%s ClientTransactionID echoed" % sPath)
+    check(jResp.get("ServerTransactionID", 0) > nLastServerTransaction, "%s ServerTransactionID increases" % sPath)
+    nLastServerTransaction = jResp.get("ServerTransactionID", 0)
+    check(isinstance(jResp.get("ErrorNumber"), int) and isinstance(jResp.get("ErrorMessage"), str), "%s error fields" % sPath)
+    return nStatus, jResp
+
+
+def device(sMethod):
+    return "/api/v1/observingconditions/0/" + sMethod
+
+
+# management
+nStatus, jResp = request("/management/apiversions")
+check(nStatus == 200 and 1 in jResp["Value"], "api version 1 listed")
+nStatus, jResp = request("/management/v1/description")
+check(re.match(r"^\d+\.\d\d$", jResp["Value"]["ManufacturerVersion"]) is not None, "ManufacturerVersion is x.yy")
+nStatus, jResp = request("/management/v1/configureddevices")
+check(len(jResp["Value"]) == 1 and jResp["Value"][0]["DeviceType"] == "ObservingConditions" and jResp["Value"][0]["DeviceNumber"] == 0,
+      "one ObservingConditions device 0")
+
+# common members
+nStatus, jResp = request(device("connected"), {"Connected": "True"}, True)
+check(jResp["ErrorNumber"] == 0, "PUT connected true")
+nStatus, jResp = request(device("connected"))
+check(jResp["Value"] is True, "connected reads back true")
+nStatus, jResp = request(device("interfaceversion"))
+check(jResp["Value"] == 1, "interfaceversion 1")
+nStatus, jResp = request(device("driverversion"))
+check(re.match(r"^\d+\.\d\d$", jResp["Value"]) is not None, "driverversion is x.yy")
+for sMethod in ("name", "description", "driverinfo"):
+    nStatus, jResp = request(device(sMethod))
+    check(isinstance(jResp["Value"], str) and jResp["Value"] != "", "%s is a non empty string" % sMethod)
+nStatus, jResp = request(device("supportedactions"))
+check(jResp["Value"] == [], "no supported actions")
+nStatus, jResp = request(device("action"), {"Action": "x", "Parameters": ""}, True)
+check(jResp["ErrorNumber"] == NOT_IMPLEMENTED, "action not implemented")
+
+# sensors
+for sSensor in ("temperature", "humidity", "dewpoint", "pressure"):
+    nStatus, jResp = request(device(sSensor))
+    check(jResp["ErrorNumber"] == 0 and isinstance(jResp["Value"], (int, float)), "%s is a number" % sSensor)
+    nStatus, jResp = request(device("timesincelastupdate"), {"SensorName": sSensor})
+    check(jResp["ErrorNumber"] == 0 and jResp["Value"] >= 0, "timesincelastupdate %s" % sSensor)
+for sSensor in ("", "Temperature", "Humidity", "DewPoint", "Pressure"):
+    nStatus, jResp = request(device("sensordescription"), {"SensorName": sSensor})
+    check(jResp["ErrorNumber"] == 0 and jResp["Value"].strip() == jResp["Value"] and jResp["Value"] != "Weather Eagle",
+          "sensordescription '%s' is '%s'" % (sSensor, jResp["Value"]))
+for sSensor in ("cloudcover", "rainrate", "skybrightness", "skyquality", "skytemperature", "starfwhm", "windspeed",
+                "winddirection", "windgust"):
+    nStatus, jResp = request(device(sSensor))
+    check(jResp["ErrorNumber"] == NOT_IMPLEMENTED, "%s not implemented" % sSensor)
+nStatus, jResp = request(device("sensordescription"), {"SensorName": "SkyTemperature"})
+check(jResp["ErrorNumber"] == NOT_IMPLEMENTED, "sensordescription of a missing sensor not implemented")
+
+# average period and refresh
+nStatus, jResp = request(device("averageperiod"))
+check(jResp["Value"] == 0.0, "averageperiod is 0")
+nStatus, jResp = request(device("averageperiod"), {"AveragePeriod": "0"}, True)
+check(jResp["ErrorNumber"] == 0, "PUT averageperiod 0")
+nStatus, jResp = request(device("averageperiod"), {"AveragePeriod": "5"}, True)
+check(jResp["ErrorNumber"] == INVALID_VALUE, "PUT averageperiod 5 is an invalid value")
+nStatus, jResp = request(device("refresh"), {}, True)
+check(jResp["ErrorNumber"] == 0, "PUT refresh")
+
+# errors
+nStatus, jResp = request(device("nosuchmethod"))
+check(nStatus == 400, "unknown method is a 400")
+nStatus, jResp = request("/api/v1/observingconditions/1/connected")
+check(nStatus == 404, "unknown device is a 404")
+
+nStatus, jResp = request(device("connected"), {"Connected": "False"}, True)
+nStatus, jResp = request(device("temperature"))
+check(jResp["ErrorNumber"] != 0, "disconnected sensors return an error")
+
+print("%d failed" % nFailed)
+sys.exit(1 if nFailed else 0)
@@ -22,16 +22,71 @@ X2WeatherStation::X2WeatherStation(const char* pszDisplayName,
     m_nPrivateISIndex               = nInstanceIndex;
 
 	m_bLinked = false;
+    m_pReadDevice = nullptr;
+    m_nActiveReaders = 0;
+    m_nDisplaySeq = 0;
+    m_nDisplayDirty = 0;
+    memset(m_szDisplay, 0, sizeof(m_szDisplay));
+    m_bProbeShown = true;
+    m_bDiscoveryShown = true;
+    CWeatherEagle::initConfig(m_Config);
+    m_Config.sIpAddress.assign("localhost");
+    m_Config.nTcpPort = 1380;
+    m_nStaleThresholdMs = DEFAULT_STALE_THRESHOLD_MS;
+    m_nRefreshWaitMs = DEFAULT_REFRESH_WAIT_MS;
+    m_Export.bSharedMemory = false;
+    m_Export.nHttpPort = 0;
+    m_Export.bAlpaca = false;
+    m_Export.nBoltwoodIntervalMs = BOLTWOOD_DEFAULT_INTERVAL_MS;
+    m_Export.nMqttPort = 0;
     if (m_pIniUtil) {
         char szIpAddress[128];
+        char szPinnedKey[256];
+        char szBindAddress[64];
+        char szBoltwoodFile[1024];
+        char szMqtt[256];
+        char szHedgeUrl[256];
         m_pIniUtil->readString(PARENT_KEY, CHILD_KEY_IP, "localhost", szIpAddress, 128);
-        m_WeatherEagle.setIpAddress(std::string(szIpAddress));
-        m_WeatherEagle.setTcpPort(m_pIniUtil->readInt(PARENT_KEY, CHILD_KEY_PORT, 1380));
+        m_Config.sIpAddress.assign(szIpAddress);
+        m_Config.nTcpPort = m_pIniUtil->readInt(PARENT_KEY, CHILD_KEY_PORT, 1380);
+        m_nStaleThresholdMs = m_pIniUtil->readInt(PARENT_KEY, CHILD_KEY_STALE_THRESHOLD, DEFAULT_STALE_THRESHOLD_MS);
+        m_nRefreshWaitMs = m_pIniUtil->readInt(PARENT_KEY, CHILD_KEY_REFRESH_WAIT, DEFAULT_REFRESH_WAIT_MS);
+        m_Config.Tls.bHttps = m_pIniUtil->readInt(PARENT_KEY, CHILD_KEY_HTTPS, 0) != 0;
+        m_Config.Tls.bVerifyPeer = m_pIniUtil->readInt(PARENT_KEY, CHILD_KEY_VERIFY_PEER, 0) != 0;
+        m_pIniUtil->readString(PARENT_KEY, CHILD_KEY_PINNED_KEY, "", szPinnedKey, 256);
+        m_Config.Tls.sPinnedPublicKey.assign(szPinnedKey);
+        m_Config.nPollIntervalMs = m_pIniUtil->readInt(PARENT_KEY, CHILD_KEY_POLL_INTERVAL, POLL_INTERVAL_MS);
+        m_Config.nConnectTimeoutMs = m_pIniUtil->readInt(PARENT_KEY, CHILD_KEY_CONNECT_TIMEOUT, DEFAULT_CONNECT_TIMEOUT_MS);
+        m_Config.nTransferTimeoutMs = m_pIniUtil->readInt(PARENT_KEY, CHILD_KEY_TRANSFER_TIMEOUT, DEFAULT_TRANSFER_TIMEOUT_MS);
+        m_Config.bHedging = m_pIniUtil->readInt(PARENT_KEY, CHILD_KEY_HEDGING, 0) != 0;
+        m_pIniUtil->readString(PARENT_KEY, CHILD_KEY_HEDGE_URL, "", szHedgeUrl, 256);
+        m_Config.sHedgeUrl.assign(szHedgeUrl);
+        m_Export.bSharedMemory = m_pIniUtil->readInt(PARENT_KEY, CHILD_KEY_SHARED_MEMORY, 0) != 0;
+        m_Export.nHttpPort = m_pIniUtil->readInt(PARENT_KEY, CHILD_KEY_HTTP_PORT, 0);
+        m_pIniUtil->readString(PARENT_KEY, CHILD_KEY_HTTP_BIND, "", szBindAddress, 64);
+        m_Export.sHttpBindAddress.assign(szBindAddress);
+        m_Export.bAlpaca = m_pIniUtil->readInt(PARENT_KEY, CHILD_KEY_ALPACA, 0) != 0;
+        m_pIniUtil->readString(PARENT_KEY, CHILD_KEY_BOLTWOOD_FILE, "", szBoltwoodFile, 1024);
+        m_Export.sBoltwoodFile.assign(szBoltwoodFile);
+        m_Export.nBoltwoodIntervalMs = m_pIniUtil->readInt(PARENT_KEY, CHILD_KEY_BOLTWOOD_INTERVAL, BOLTWOOD_DEFAULT_INTERVAL_MS);
+        m_pIniUtil->readString(PARENT_KEY, CHILD_KEY_MQTT_HOST, "", szMqtt, 256);
+        m_Export.sMqttHost.assign(szMqtt);
+        m_Export.nMqttPort = m_pIniUtil->readInt(PARENT_KEY, CHILD_KEY_MQTT_PORT, 0);
+        m_pIniUtil->readString(PARENT_KEY, CHILD_KEY_MQTT_PREFIX, "", szMqtt, 256);
+        m_Export.sMqttTopicPrefix.assign(szMqtt);
+        m_pIniUtil->readString(PARENT_KEY, CHILD_KEY_MQTT_USER, "", szMqtt, 256);
+        m_Export.sMqttUser.assign(szMqtt);
+        m_pIniUtil->readString(PARENT_KEY, CHILD_KEY_MQTT_PASSWORD, "", szMqtt, 256);
+        m_Export.sMqttPassword.assign(szMqtt);
     }
 }
 
 X2WeatherStation::~X2WeatherStation()
 {
+    m_pReadDevice = nullptr;
+    if(m_pWeatherEagle)
+        CWeatherEagleRegistry::release(m_pWeatherEagle);
+
 	//Delete objects used through composition
 	if (GetSerX())
 		delete GetSerX();
@@ -72,7 +127,9 @@ int X2WeatherStation::execModalSettingsDialog()
     X2GUIExchangeInterface*            dx = NULL;//Comes after ui is loaded
     bool bPressedOK = false;
 
-    std::stringstream ssTmp;
+    WeatherEagleSnapshot Snapshot;
+    WeatherEagleConfig Config;
+    int nDataAge;
 
     if (NULL == ui)
         return ERR_POINTER;
@@ -83,78 +140,240 @@ int X2WeatherStation::execModalSettingsDialog()
     if (NULL == (dx = uiutil.X2DX())) {
         return ERR_POINTER;
     }
-    X2MutexLocker ml(GetMutex());
+    // cached values only, no need for the X2 I/O mutex
+    if(readSnapshot(Snapshot, nDataAge, false)) {
+        formatDisplay(Snapshot);
+        pushDisplay(dx, true);
+    }
 
-    if(m_bLinked) { // we can't change the value for the ip and port if we're connected
-        ssTmp<< std::fixed << std::setprecision(2) << m_WeatherEagle.getAmbianTemp() << " C";
-        dx->setPropertyString("temperature", "text", ssTmp.str().c_str());
+    // settings can be changed while connected, they're applied to the running device on OK
+    dx->setText("IPAddress", m_Config.sIpAddress.c_str());
+    dx->setPropertyInt("tcpPort", "value", m_Config.nTcpPort);
+    dx->setPropertyInt("pollInterval", "value", m_Config.nPollIntervalMs);
+    dx->setPropertyInt("connectTimeout", "value", m_Config.nConnectTimeoutMs);
+    dx->setPropertyInt("transferTimeout", "value", m_Config.nTransferTimeoutMs);
+    m_bProbeShown = true;
+    m_bDiscoveryShown = true;
+    m_vDiscovered.clear();
 
-        std::stringstream().swap(ssTmp);
-        ssTmp<< std::dec << m_WeatherEagle.getHumidity() << " %";
-        dx->setPropertyString("humidity", "text", ssTmp.str().c_str());
+    //Display the user interface
+    nErr = ui->exec(bPressedOK);
+    // don't leave a test or a scan running once the dialog is gone
+    m_Probe.cancel();
+    m_Discovery.cancel();
+    if (nErr)
+        return nErr;
 
-        std::stringstream().swap(ssTmp);
-        ssTmp<< std::fixed << std::setprecision(2) << m_WeatherEagle.getDewPointTemp() << " C";
-        dx->setPropertyString("dewPoint", "text", ssTmp.str().c_str());
+    //Retreive values from the user interface
+    if (bPressedOK) {
+        readDialogConfig(dx, Config);
+        nErr = applyConfig(Config);
+    }
+    return nErr;
+}
 
-        std::stringstream().swap(ssTmp);
-        ssTmp<< std::fixed << std::setprecision(2) << m_WeatherEagle.getBarometricPressure() << " mbar";
-        dx->setPropertyString("pressure", "text", ssTmp.str().c_str());
+void X2WeatherStation::uiEvent(X2GUIExchangeInterface* uiex, const char* pszEvent)
+{
+    WeatherEagleSnapshot Snapshot;
+    int nDataAge;
+
+    WeatherEagleConfig Config;
+
+    if (!strcmp(pszEvent, "on_timer")) {
+        if(readSnapshot(Snapshot, nDataAge, false)) {
+            // only the fields that changed since the last tick are sent to the dialog
+            formatDisplay(Snapshot);
+            pushDisplay(uiex, false);
+        }
+        if(!m_bProbeShown && m_Probe.getState() == PROBE_DONE)
+            showProbeResult(uiex);
+        if(!m_bDiscoveryShown && m_Discovery.getState() == DISCOVERY_DONE)
+            showDiscoveryResult(uiex);
+    }
+    else if (!strcmp(pszEvent, "on_pushButtonDiscover_clicked")) {
+        startDiscovery(uiex);
+    }
+    else if (!strcmp(pszEvent, "on_discoveredDevices_currentIndexChanged")) {
+        int nIndex = uiex->currentIndex("discoveredDevices");
+        if(nIndex >= 0 && nIndex < int(m_vDiscovered.size())) {
+            uiex->setText("IPAddress", m_vDiscovered[nIndex].sIpAddress.c_str());
+            uiex->setPropertyInt("tcpPort", "value", m_vDiscovered[nIndex].nTcpPort);
+        }
+    }
+    else if (!strcmp(pszEvent, "on_pushButtonTest_clicked")) {
+        // test what's typed in the dialog, not what's saved
+        readDialogConfig(uiex, Config);
+        if(m_Probe.start(Config)) {
+            m_bProbeShown = false;
+            uiex->setEnabled("pushButtonTest", false);
+            uiex->setText("testResult", ("Testing " + Config.sIpAddress + ":" + std::to_string(Config.nTcpPort) + " ...").c_str());
+        }
+        else
+            uiex->setText("testResult", "Test could not be started");
+    }
+}
 
-        std::stringstream().swap(ssTmp);
-        ssTmp<< std::fixed << std::setprecision(2) << m_WeatherEagle.getExteSensorTemp(5) << " ºC";
-        dx->setPropertyString("port5_Temp", "text", ssTmp.str().c_str());
+void X2WeatherStation::readDialogConfig(X2GUIExchangeInterface* uiex, WeatherEagleConfig &Config)
+{
+    char szIpAddress[128];
+
+    Config = m_Config;
+    uiex->text("IPAddress", szIpAddress, 128);
+    Config.sIpAddress.assign(szIpAddress);
+    uiex->propertyInt("tcpPort", "value", Config.nTcpPort);
+    uiex->propertyInt("pollInterval", "value", Config.nPollIntervalMs);
+    uiex->propertyInt("connectTimeout", "value", Config.nConnectTimeoutMs);
+    uiex->propertyInt("transferTimeout", "value", Config.nTransferTimeoutMs);
+}
+
+void X2WeatherStation::showProbeResult(X2GUIExchangeInterface* uiex)
+{
+    EagleProbeResult Result;
+    std::stringstream ssResult;
 
-        std::stringstream().swap(ssTmp);
-        ssTmp<< std::fixed << std::setprecision(2) << m_WeatherEagle.getExteSensorTemp(6) << " ºC";
-        dx->setPropertyString("port6_Temp", "text", ssTmp.str().c_str());
+    m_Probe.getResult(Result);
+    m_bProbeShown = true;
+    uiex->setEnabled("pushButtonTest", true);
 
-        std::stringstream().swap(ssTmp);
-        ssTmp<< std::fixed << std::setprecision(2) << m_WeatherEagle.getExteSensorTemp(7) << " ºC";
-        dx->setPropertyString("port7_Temp", "text", ssTmp.str().c_str());
+    if(Result.nErr) {
+        ssResult << "No answer : " << Result.sError;
+        uiex->setText("testResult", ssResult.str().c_str());
+        return;
     }
+    if(Result.nInfoMs >= 0)
+        ssResult << (Result.sModel.empty() ? "Eagle" : Result.sModel) << " firmware " << (Result.sFirmware.empty() ? "?" : Result.sFirmware)
+                 << ", connect " << Result.nConnectMs << " ms, /getinfo " << Result.nInfoMs << " ms\n";
+    if(Result.nSamples)
+        ssResult << "/getecco min " << Result.nMinMs << " / median " << Result.nMedianMs << " / max " << Result.nMaxMs << " ms, "
+                 << Result.nValidSamples << "/" << Result.nSamples << " valid";
+    else
+        ssResult << "/getecco failed";
+    if(!Result.sError.empty())
+        ssResult << "\n" << Result.sError;
+    uiex->setText("testResult", ssResult.str().c_str());
+}
 
-    //Display the user interface
-    if ((nErr = ui->exec(bPressedOK)))
-        return nErr;
+// Sweep the /24 around the address typed in the dialog, on its port and the Eagle default one.
+void X2WeatherStation::startDiscovery(X2GUIExchangeInterface* uiex)
+{
+    WeatherEagleConfig Config;
+    std::vector<EagleDiscoveryTarget> vTargets;
+    std::vector<int> vPorts;
+
+    readDialogConfig(uiex, Config);
+    vPorts.push_back(Config.nTcpPort);
+    if(Config.nTcpPort != DISCOVERY_DEFAULT_PORT)
+        vPorts.push_back(DISCOVERY_DEFAULT_PORT);
+
+    if(!CEagleDiscovery::expandTargets(Config.sIpAddress, vPorts, vTargets) || !m_Discovery.start(vTargets)) {
+        uiex->setText("testResult", "Discovery could not be started");
+        return;
+    }
+    m_bDiscoveryShown = false;
+    uiex->setEnabled("pushButtonDiscover", false);
+    uiex->setText("testResult", ("Scanning " + std::to_string(vTargets.size()) + " addresses around " + Config.sIpAddress + " ...").c_str());
+}
 
-    //Retreive values from the user interface
-    if (bPressedOK) {
+void X2WeatherStation::showDiscoveryResult(X2GUIExchangeInterface* uiex)
+{
+    std::stringstream ssEntry;
+    std::string sIpAddress;
+    int nElapsedMs;
+    int nCurrent = 0;
+    int nTcpPort = 0;
+    char szIpAddress[128];
+
+    m_Discovery.getResults(m_vDiscovered, nElapsedMs);
+    m_bDiscoveryShown = true;
+    uiex->setEnabled("pushButtonDiscover", true);
+
+    // keep what's typed selected if it was found, the combo box change event overwrites the fields
+    uiex->text("IPAddress", szIpAddress, 128);
+    sIpAddress.assign(szIpAddress);
+    uiex->propertyInt("tcpPort", "value", nTcpPort);
+
+    uiex->comboBoxClear("discoveredDevices");
+    for(size_t i = 0; i < m_vDiscovered.size(); i++) {
+        const EagleDiscoveryHit &Hit = m_vDiscovered[i];
+        ssEntry.str("");
+        ssEntry << Hit.sIpAddress << ":" << Hit.nTcpPort << "  " << Hit.sModel << " " << Hit.sFirmware << " (" << Hit.nLatencyMs << " ms)";
+        uiex->comboBoxAppendString("discoveredDevices", ssEntry.str().c_str());
+        if(Hit.sIpAddress == sIpAddress && Hit.nTcpPort == nTcpPort)
+            nCurrent = int(i);
+    }
+    if(!m_vDiscovered.empty())
+        uiex->setCurrentIndex("discoveredDevices", nCurrent);
+
+    ssEntry.str("");
+    ssEntry << m_vDiscovered.size() << " device" << (m_vDiscovered.size() == 1 ? "" : "s") << " found in " << nElapsedMs << " ms";
+    uiex->setText("testResult", ssEntry.str().c_str());
+}
+
+// Save the dialog settings and hand them to the running device, if any.
+int X2WeatherStation::applyConfig(const WeatherEagleConfig &Config)
+{
+    int nErr = SB_OK;
+    std::shared_ptr<CWeatherEagle> pOld;
+
+    X2MutexLocker ml(GetMutex());
+
+    if(Config.sIpAddress.empty())
+        return ERR_CMDFAILED;
+    m_Config = Config;
+    if (m_pIniUtil) {
+        m_pIniUtil->writeString(PARENT_KEY, CHILD_KEY_IP, m_Config.sIpAddress.c_str());
+        m_pIniUtil->writeInt(PARENT_KEY, CHILD_KEY_PORT, m_Config.nTcpPort);
+        m_pIniUtil->writeInt(PARENT_KEY, CHILD_KEY_POLL_INTERVAL, m_Config.nPollIntervalMs);
+        m_pIniUtil->writeInt(PARENT_KEY, CHILD_KEY_CONNECT_TIMEOUT, m_Config.nConnectTimeoutMs);
+        m_pIniUtil->writeInt(PARENT_KEY, CHILD_KEY_TRANSFER_TIMEOUT, m_Config.nTransferTimeoutMs);
+    }
+    if(!m_bLinked || !m_pWeatherEagle)
+        return SB_OK;
+
+    pOld = m_pWeatherEagle;
+    nErr = CWeatherEagleRegistry::reconfigure(m_pWeatherEagle, m_Config);
+    if(m_pWeatherEagle != pOld) {
+        // moved to another device, pOld keeps the old one alive until the readers let go of it
+        m_pReadDevice = m_pWeatherEagle.get();
+        pOld->cancelRefreshWaits();
+        while(m_nActiveReaders)
+            std::this_thread::yield();
     }
     return nErr;
 }
 
-void X2WeatherStation::uiEvent(X2GUIExchangeInterface* uiex, const char* pszEvent)
+// Format the display strings once per published snapshot and flag the ones that changed.
+void X2WeatherStation::formatDisplay(const WeatherEagleSnapshot &Snapshot)
+{
+    static const char *szUnits[DISPLAY_FIELDS] = {" C", " %", " C", " mbar", " ºC", " ºC", " ºC"};
+    const double dValues[DISPLAY_FIELDS] = {Snapshot.dTemp, Snapshot.dPercentHumdity, Snapshot.dDewPointTemp, Snapshot.dBarometricPressure,
+                                            Snapshot.dExtTemp[0], Snapshot.dExtTemp[1], Snapshot.dExtTemp[2]};
+    char szTmp[DISPLAY_BUFFER_SIZE];
+
+    if(Snapshot.nSeq == m_nDisplaySeq)
+        return;
+    m_nDisplaySeq = Snapshot.nSeq;
+
+    for(int i = 0; i < DISPLAY_FIELDS; i++) {
+        // humidity keeps the short form the stream output used to give
+        snprintf(szTmp, sizeof(szTmp), i == DISPLAY_HUMIDITY ? "%g%s" : "%.2f%s", dValues[i], szUnits[i]);
+
+        if(strcmp(szTmp, m_szDisplay[i])) {
+            memcpy(m_szDisplay[i], szTmp, sizeof(szTmp));
+            m_nDisplayDirty |= (1 << i);
+        }
+    }
+}
+
+void X2WeatherStation::pushDisplay(X2GUIExchangeInterface* uiex, bool bAll)
 {
-    std::stringstream ssTmp;
-    if (!strcmp(pszEvent, "on_timer") && m_bLinked) {
-        ssTmp<< std::fixed << std::setprecision(2) << m_WeatherEagle.getAmbianTemp() << " C";
-        uiex->setPropertyString("temperature", "text", ssTmp.str().c_str());
-
-        std::stringstream().swap(ssTmp);
-        ssTmp<< std::dec << m_WeatherEagle.getHumidity() << " %";
-        uiex->setPropertyString("humidity", "text", ssTmp.str().c_str());
-
-        std::stringstream().swap(ssTmp);
-        ssTmp<< std::fixed << std::setprecision(2) << m_WeatherEagle.getDewPointTemp() << " C";
-        uiex->setPropertyString("dewPoint", "text", ssTmp.str().c_str());
-
-        std::stringstream().swap(ssTmp);
-        ssTmp<< std::fixed << std::setprecision(2) << m_WeatherEagle.getBarometricPressure() << " mbar";
-        uiex->setPropertyString("pressure", "text", ssTmp.str().c_str());
-
-        std::stringstream().swap(ssTmp);
-        ssTmp<< std::fixed << std::setprecision(2) << m_WeatherEagle.getExteSensorTemp(5) << " ºC";
-        uiex->setPropertyString("port5_Temp", "text", ssTmp.str().c_str());
-
-        std::stringstream().swap(ssTmp);
-        ssTmp<< std::fixed << std::setprecision(2) << m_WeatherEagle.getExteSensorTemp(6) << " ºC";
-        uiex->setPropertyString("port6_Temp", "text", ssTmp.str().c_str());
-
-        std::stringstream().swap(ssTmp);
-        ssTmp<< std::fixed << std::setprecision(2) << m_WeatherEagle.getExteSensorTemp(7) << " ºC";
-        uiex->setPropertyString("port7_Temp", "text", ssTmp.str().c_str());
+    static const char *szWidgets[DISPLAY_FIELDS] = {"temperature", "humidity", "dewPoint", "pressure", "port5_Temp", "port6_Temp", "port7_Temp"};
+
+    for(int i = 0; i < DISPLAY_FIELDS; i++) {
+        if(bAll || (m_nDisplayDirty & (1 << i)))
+            uiex->setPropertyString(szWidgets[i], "text", m_szDisplay[i]);
     }
+    m_nDisplayDirty = 0;
 }
 
 void X2WeatherStation::driverInfoDetailedInfo(BasicStringInterface& str) const
@@ -184,13 +403,12 @@ void X2WeatherStation::deviceInfoDetailedDescription(BasicStringInterface& str)
 
 void X2WeatherStation::deviceInfoFirmwareVersion(BasicStringInterface& str)
 {
-    if(m_bLinked) {
-        str = "N/A";
-        std::string sFirmware;
-        X2MutexLocker ml(GetMutex());
-        m_WeatherEagle.getFirmware(sFirmware);
-        str = sFirmware.c_str();
-    }
+    WeatherEagleSnapshot Snapshot;
+    int nDataAge;
+
+    // the firmware version is part of the published snapshot, no need for the X2 mutex
+    if(readSnapshot(Snapshot, nDataAge, false) && Snapshot.szFirmware[0])
+        str = Snapshot.szFirmware;
     else
         str = "N/A";
 
@@ -198,7 +416,14 @@ void X2WeatherStation::deviceInfoFirmwareVersion(BasicStringInterface& str)
 
 void X2WeatherStation::deviceInfoModel(BasicStringInterface& str)
 {
-    deviceInfoNameShort(str);
+    WeatherEagleSnapshot Snapshot;
+    int nDataAge;
+
+    // model reported by the capability probe
+    if(readSnapshot(Snapshot, nDataAge, false) && Snapshot.szModel[0])
+        str = Snapshot.szModel;
+    else
+        deviceInfoNameShort(str);
 }
 
 int	X2WeatherStation::establishLink(void)
@@ -207,20 +432,37 @@ int	X2WeatherStation::establishLink(void)
 
     X2MutexLocker ml(GetMutex());
 
-    nErr = m_WeatherEagle.Connect();
-    if(nErr)
+    // other instances talking to the same Eagle share its connection and poller
+    m_pWeatherEagle = CWeatherEagleRegistry::acquire(m_Config, m_Export, nErr);
+    if(nErr || !m_pWeatherEagle) {
         m_bLinked = false;
-    else
+    }
+    else {
+        m_pReadDevice = m_pWeatherEagle.get();
         m_bLinked = true;
+    }
 
 	return nErr;
 }
 int	X2WeatherStation::terminateLink(void)
 {
+    std::shared_ptr<CWeatherEagle> pWeatherEagle;
 
-    m_WeatherEagle.Disconnect();
+    {
+        X2MutexLocker ml(GetMutex());
+        m_bLinked = false;
+        // unpublish the device and let the lock free readers finish their copy
+        m_pReadDevice = nullptr;
+        // don't wait for a reader blocked on an on demand refresh
+        if(m_pWeatherEagle)
+            m_pWeatherEagle->cancelRefreshWaits();
+        while(m_nActiveReaders)
+            std::this_thread::yield();
+        pWeatherEagle.swap(m_pWeatherEagle);
+    }
+    // disconnects only if we were the last instance using this device
+    CWeatherEagleRegistry::release(pWeatherEagle);
 
-	m_bLinked = false;
 	return SB_OK;
 }
 
@@ -230,6 +472,33 @@ bool X2WeatherStation::isLinked(void) const
 	return m_bLinked;
 }
 
+// Copy the last published readings without taking any lock.
+// Returns false if not linked or no data has been received yet.
+bool X2WeatherStation::readSnapshot(WeatherEagleSnapshot &Snapshot, int &nDataAge, bool bRefreshIfStale)
+{
+    CWeatherEagle *pDevice;
+    int64_t nNowMs;
+
+    nDataAge = -1;
+    m_nActiveReaders++;
+    pDevice = m_pReadDevice;
+    if(!pDevice) {
+        m_nActiveReaders--;
+        return false;
+    }
+    if(bRefreshIfStale) // single flight background poll if the data is too old
+        pDevice->refreshIfStale(m_nStaleThresholdMs, m_nRefreshWaitMs);
+    pDevice->getSnapshot(Snapshot);
+    m_nActiveReaders--;
+
+    if(!Snapshot.nSeq)
+        return false;
+
+    nNowMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    nDataAge = int(nNowMs - Snapshot.nTimestampMs);
+    return true;
+}
+
 
 int X2WeatherStation::weatherStationData(double& dSkyTemp,
                                          double& dAmbTemp,
@@ -251,13 +520,17 @@ int X2WeatherStation::weatherStationData(double& dSkyTemp,
 )
 {
     int nErr = SB_OK;
+    int nDataAge;
+    WeatherEagleSnapshot Snapshot;
 
     if(!m_bLinked)
         return ERR_NOLINK;
 
-    X2MutexLocker ml(GetMutex());
+    // cached data only, served without the X2 I/O mutex
+    if(!readSnapshot(Snapshot, nDataAge, true))
+        return m_bLinked ? ERR_CMDFAILED : ERR_NOLINK;
 
-    nSecondsSinceGoodData = 1; // was 900 , aka 15 minutes ?
+    nSecondsSinceGoodData = nDataAge / 1000;
     nRoofCloseThisCycle = 0;
     /*
     nRainFlag = 0;
@@ -267,20 +540,26 @@ int X2WeatherStation::weatherStationData(double& dSkyTemp,
     rainCondition = x2RainCond::rainDry;
     */
 
-    dAmbTemp = m_WeatherEagle.getAmbianTemp();
-	nPercentHumdity = int(m_WeatherEagle.getHumidity());
-	dDewPointTemp = m_WeatherEagle.getDewPointTemp();
-    dBarometricPressure = m_WeatherEagle.getBarometricPressure();
+    dAmbTemp = Snapshot.dTemp;
+	nPercentHumdity = int(Snapshot.dPercentHumdity);
+	dDewPointTemp = Snapshot.dDewPointTemp;
+    dBarometricPressure = Snapshot.dBarometricPressure;
 	return nErr;
 }
 
 WeatherStationDataInterface::x2WindSpeedUnit X2WeatherStation::windSpeedUnit()
 {
     WeatherStationDataInterface::x2WindSpeedUnit nUnit = WeatherStationDataInterface::x2WindSpeedUnit::windSpeedKph;
-    int WeatherEagleUnit;
+    int WeatherEagleUnit = KPH;
     std::stringstream tmp;
-
-    WeatherEagleUnit = m_WeatherEagle.getWindSpeedUnit(WeatherEagleUnit);
+    CWeatherEagle *pDevice;
+
+    // called without the X2 I/O mutex, same reader path as readSnapshot
+    m_nActiveReaders++;
+    pDevice = m_pReadDevice;
+    if(pDevice)
+        pDevice->getWindSpeedUnit(WeatherEagleUnit);
+    m_nActiveReaders--;
 
     switch(WeatherEagleUnit) {
         case KPH:
@@ -3,6 +3,7 @@
 #ifndef __X2WeatherStation_H_
 #define __X2WeatherStation_H_
 
+#include <stdio.h>
 #include <string.h>
 
 #include "../../licensedinterfaces/theskyxfacadefordriversinterface.h"
@@ -23,6 +24,8 @@
 
 
 #include "WeatherEagle.h"
+#include "EagleProbe.h"
+#include "EagleDiscovery.h"
 
 
 #define PARENT_KEY      "WeatherEagle"
@@ -32,9 +35,35 @@
 #define CHILD_KEY_CLOSE_ON_WINDY  "CloseOnWindy"
 
 #define CHILD_KEY_VERY_WINDY  "VeryWindy"
+#define CHILD_KEY_STALE_THRESHOLD   "StaleThresholdMs"
+#define CHILD_KEY_REFRESH_WAIT      "RefreshWaitMs"
+#define CHILD_KEY_HTTPS             "UseHttps"
+#define CHILD_KEY_VERIFY_PEER       "VerifyPeer"
+#define CHILD_KEY_PINNED_KEY        "PinnedPublicKey"
+#define CHILD_KEY_POLL_INTERVAL     "PollIntervalMs"
+#define CHILD_KEY_CONNECT_TIMEOUT   "ConnectTimeoutMs"
+#define CHILD_KEY_TRANSFER_TIMEOUT  "TransferTimeoutMs"
+#define CHILD_KEY_HEDGING           "Hedging"
+#define CHILD_KEY_HEDGE_URL         "HedgeUrl"
+#define CHILD_KEY_SHARED_MEMORY     "SharedMemory"
+#define CHILD_KEY_HTTP_PORT         "HttpPort"
+#define CHILD_KEY_HTTP_BIND         "HttpBindAddress"
+#define CHILD_KEY_ALPACA            "Alpaca"
+#define CHILD_KEY_BOLTWOOD_FILE     "BoltwoodFile"
+#define CHILD_KEY_BOLTWOOD_INTERVAL "BoltwoodIntervalMs"
+#define CHILD_KEY_MQTT_HOST         "MqttHost"
+#define CHILD_KEY_MQTT_PORT         "MqttPort"
+#define CHILD_KEY_MQTT_PREFIX       "MqttTopicPrefix"
+#define CHILD_KEY_MQTT_USER         "MqttUser"
+#define CHILD_KEY_MQTT_PASSWORD     "MqttPassword"
 
 #define LOG_BUFFER_SIZE 8192
 
+// settings dialog display fields, in widget order
+#define DISPLAY_FIELDS      7
+#define DISPLAY_BUFFER_SIZE 32
+enum X2DisplayFields {DISPLAY_TEMP=0, DISPLAY_HUMIDITY, DISPLAY_DEWPOINT, DISPLAY_PRESSURE, DISPLAY_PORT5, DISPLAY_PORT6, DISPLAY_PORT7};
+
 // Forward declare the interfaces that this device is dependent upon
 class SerXInterface;
 class TheSkyXFacadeForDriversInterface;
@@ -155,9 +184,37 @@ private:
 
 
     int         m_nPrivateISIndex;
-	bool m_bLinked;
-
-    CWeatherEagle        m_WeatherEagle;
+	std::atomic<bool> m_bLinked;
+
+    WeatherEagleConfig  m_Config;       // endpoint, TLS, cadence and deadlines
+    int                 m_nStaleThresholdMs;
+    int                 m_nRefreshWaitMs;
+    WeatherEagleExportSettings  m_Export;
+    std::shared_ptr<CWeatherEagle>  m_pWeatherEagle;    // shared with other instances using the same device, only set while linked
+
+    // lock free read path for the cached values, terminateLink waits for the readers to drain
+    std::atomic<CWeatherEagle*>     m_pReadDevice;
+    std::atomic<int>                m_nActiveReaders;
+    bool                            readSnapshot(WeatherEagleSnapshot &Snapshot, int &nDataAge, bool bRefreshIfStale);
+
+    // preformatted dialog strings, rebuilt only when a new snapshot is published
+    char                m_szDisplay[DISPLAY_FIELDS][DISPLAY_BUFFER_SIZE];
+    uint32_t            m_nDisplayDirty;
+    uint64_t            m_nDisplaySeq;
+    void                formatDisplay(const WeatherEagleSnapshot &Snapshot);
+    void                pushDisplay(X2GUIExchangeInterface* uiex, bool bAll);
+
+    // settings dialog, Test and Discover run in the background and report on the dialog timer
+    CEagleProbe         m_Probe;
+    bool                m_bProbeShown;
+    CEagleDiscovery     m_Discovery;
+    bool                m_bDiscoveryShown;
+    std::vector<EagleDiscoveryHit>  m_vDiscovered;  // discoveredDevices combo box entries
+    void                readDialogConfig(X2GUIExchangeInterface* uiex, WeatherEagleConfig &Config);
+    void                showProbeResult(X2GUIExchangeInterface* uiex);
+    void                startDiscovery(X2GUIExchangeInterface* uiex);
+    void                showDiscoveryResult(X2GUIExchangeInterface* uiex);
+    int                 applyConfig(const WeatherEagleConfig &Config);
 
 };
 